@@ -642,7 +642,22 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    /*
+     * Go straight to the RAM dirty bitmaps instead of the slot bitmap,
+     * so that a sync only costs as much as the number of pages dirtied
+     * since the last one, rather than a walk over every slot.
+     *
+     * The ring reports a page again each time it is dirtied after being
+     * reset, so the slot bitmap is still used to count each page once
+     * per sync while the dirty rate is measured.
+     */
+    if (unlikely(global_dirty_tracking & GLOBAL_DIRTY_DIRTY_RATE) &&
+        !test_and_set_bit(offset, mem->dirty_bmap)) {
+        total_dirty_pages++;
+    }
+    cpu_physical_memory_set_dirty_host_page(mem->ram_start_offset +
+                                            offset *
+                                            qemu_real_host_page_size());
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -763,11 +778,12 @@ static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
      *     once rather than once per page.  And more importantly,
      *
      * (2) We must _NOT_ publish dirty bits to the other threads
-     *     (e.g., the migration thread) via the kvm memory slot dirty
-     *     bitmaps before correctly re-protect those dirtied pages.
-     *     Otherwise we can have potential risk of data corruption if
-     *     the page data is read in the other thread before we do
-     *     reset below.
+     *     (e.g., the migration thread) via the RAM dirty bitmaps
+     *     before correctly re-protect those dirtied pages.  Otherwise
+     *     we can have potential risk of data corruption if the page
+     *     data is read in the other thread before we do reset below.
+     *     The BQL, which the consumers of the RAM dirty bitmaps take
+     *     to sync them, covers the window until the reset.
      */
     kvm_slots_lock();
     total = kvm_dirty_ring_reap_locked(s, cpu);
@@ -796,10 +812,9 @@ static void kvm_cpu_synchronize_kick_all(void)
 }
 
 /*
- * Flush all the existing dirty pages to the KVM slot buffers.  When
+ * Flush all the existing dirty pages to the RAM dirty bitmaps.  When
  * this call returns, we guarantee that all the touched dirty pages
- * before calling this function have been put into the per-kvmslot
- * dirty bitmap.
+ * before calling this function have been marked there.
  *
  * This function must be called with BQL held.
  */
@@ -1362,13 +1377,13 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                 if (kvm_state->kvm_dirty_ring_size) {
                     kvm_dirty_ring_reap_locked(kvm_state, NULL);
                     if (kvm_state->kvm_dirty_ring_with_bitmap) {
-                        kvm_slot_sync_dirty_pages(mem);
                         kvm_slot_get_dirty_log(kvm_state, mem);
+                        kvm_slot_sync_dirty_pages(mem);
                     }
                 } else {
                     kvm_slot_get_dirty_log(kvm_state, mem);
+                    kvm_slot_sync_dirty_pages(mem);
                 }
-                kvm_slot_sync_dirty_pages(mem);
             }
 
             /* unregister the slot */
@@ -1637,9 +1652,30 @@ static void kvm_log_sync_global(MemoryListener *l, bool last_stage)
     KVMSlot *mem;
     int i;
 
-    /* Flush all kernel dirty addresses into KVMSlot dirty bitmap */
+    /* Flush all kernel dirty addresses into the RAM dirty bitmaps */
     kvm_dirty_ring_flush();
 
+    /* Pages dirtied from now on count again towards the dirty rate */
+    if (unlikely(global_dirty_tracking & GLOBAL_DIRTY_DIRTY_RATE)) {
+        kvm_slots_lock();
+        for (i = 0; i < s->nr_slots; i++) {
+            mem = &kml->slots[i];
+            if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+                kvm_slot_reset_dirty_pages(mem);
+            }
+        }
+        kvm_slots_unlock();
+    }
+
+    /*
+     * The ring is all there is, unless the backup bitmap has to be
+     * collected too.  KVM_GET_DIRTY_LOG overwrites the whole slot bitmap,
+     * so there is nothing to reset afterwards.
+     */
+    if (!s->kvm_dirty_ring_with_bitmap || !last_stage) {
+        return;
+    }
+
     /*
      * TODO: make this faster when nr_slots is big while there are
      * only a few used slots (small VMs).
@@ -1647,20 +1683,9 @@ static void kvm_log_sync_global(MemoryListener *l, bool last_stage)
     kvm_slots_lock();
     for (i = 0; i < s->nr_slots; i++) {
         mem = &kml->slots[i];
-        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES &&
+            kvm_slot_get_dirty_log(s, mem)) {
             kvm_slot_sync_dirty_pages(mem);
-
-            if (s->kvm_dirty_ring_with_bitmap && last_stage &&
-                kvm_slot_get_dirty_log(s, mem)) {
-                kvm_slot_sync_dirty_pages(mem);
-            }
-
-            /*
-             * This is not needed by KVM_GET_DIRTY_LOG because the
-             * ioctl will unconditionally overwrite the whole region.
-             * However kvm dirty ring has no such side effect.
-             */
-            kvm_slot_reset_dirty_pages(mem);
         }
     }
     kvm_slots_unlock();
@@ -338,6 +338,25 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_dump_stats(GString *buf)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        CPUTLBCommon *c = &env_tlb(env)->c;
+        size_t victim = qatomic_read(&c->victim_hit_count);
+        size_t fill = qatomic_read(&c->fill_count);
+
+        g_string_append_printf(buf, "CPU#%d TLB misses %zu: victim hits %zu "
+                               "(%zu%%), fills %zu, large page flushes %zu\n",
+                               cpu->cpu_index, victim + fill, victim,
+                               victim + fill ? victim * 100 / (victim + fill)
+                                             : 0,
+                               fill, qatomic_read(&c->large_flush_count));
+    }
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -492,6 +511,109 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
+static inline target_ulong tlb_full_page_mask(const CPUTLBEntryFull *full)
+{
+    return (target_ulong)-1 << MAX(full->lg_page_size, TARGET_PAGE_BITS);
+}
+
+/* Our TLB does not support large pages, so remember the area covered by
+   large pages and scan the whole TLB if a page inside it is invalidated.  */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               target_ulong vaddr, target_ulong size)
+{
+    target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
+    target_ulong lp_mask = ~(size - 1);
+
+    if (lp_addr == (target_ulong)-1) {
+        /* No previous large page.  */
+        lp_addr = vaddr;
+    } else {
+        /* Extend the existing region to include the new page.
+           This is a compromise between unnecessary flushes and
+           the cost of maintaining a full variable size TLB.  */
+        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
+        while (((lp_addr ^ vaddr) & lp_mask) != 0) {
+            lp_mask <<= 1;
+        }
+    }
+    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
+    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
+}
+
+/*
+ * Return the page of a TLB entry that is in use, from whichever of its
+ * addresses is valid.
+ */
+static target_ulong tlb_entry_page(const CPUTLBEntry *te)
+{
+    target_ulong addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = te->addr_write;
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr & TARGET_PAGE_MASK;
+}
+
+static void tlb_readd_large_page(CPUArchState *env, int midx,
+                                 const CPUTLBEntry *te,
+                                 const CPUTLBEntryFull *full)
+{
+    if (!tlb_entry_is_empty(te) && full->lg_page_size > TARGET_PAGE_BITS) {
+        target_ulong size = (target_ulong)1 << full->lg_page_size;
+
+        tlb_add_large_page(env, midx, tlb_entry_page(te) & ~(size - 1), size);
+    }
+}
+
+/*
+ * Entries are installed one target page at a time, so a large page may
+ * occupy many slots of the table.  Drop every entry whose page, at the
+ * size it was installed with, contains @page, and recompute the area
+ * covered by large pages from the entries that survive; otherwise every
+ * later flush in the old area would scan the table again.
+ *
+ * Tables that have grown past the default size are flushed in full
+ * instead: the scan would be as long as the flush, and the full flush
+ * is where the table gets the chance to shrink back.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_large_page_locked(CPUArchState *env, int midx,
+                                        target_ulong page)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    size_t i, n = tlb_n_entries(f);
+
+    if (n > 1 << CPU_TLB_DYN_DEFAULT_BITS) {
+        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        return;
+    }
+
+    d->large_page_addr = -1;
+    d->large_page_mask = -1;
+    for (i = 0; i < n; i++) {
+        if (tlb_flush_entry_mask_locked(&f->table[i], page,
+                                        tlb_full_page_mask(&d->fulltlb[i]))) {
+            tlb_n_used_entries_dec(env, midx);
+        } else {
+            tlb_readd_large_page(env, midx, &f->table[i], &d->fulltlb[i]);
+        }
+    }
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        if (tlb_flush_entry_mask_locked(&d->vtable[i], page,
+                                        tlb_full_page_mask(&d->vfulltlb[i]))) {
+            tlb_n_used_entries_dec(env, midx);
+        } else {
+            tlb_readd_large_page(env, midx, &d->vtable[i], &d->vfulltlb[i]);
+        }
+    }
+    qatomic_set(&env_tlb(env)->c.large_flush_count,
+                env_tlb(env)->c.large_flush_count + 1);
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
@@ -500,10 +622,10 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d ("
+        tlb_debug("flushing large page midx %d ("
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        tlb_flush_large_page_locked(env, midx, page);
     } else {
         if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
             tlb_n_used_entries_dec(env, midx);
@@ -1082,30 +1204,6 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
-                               target_ulong vaddr, target_ulong size)
-{
-    target_ulong lp_addr = env_tlb(env)->d[mmu_idx].large_page_addr;
-    target_ulong lp_mask = ~(size - 1);
-
-    if (lp_addr == (target_ulong)-1) {
-        /* No previous large page.  */
-        lp_addr = vaddr;
-    } else {
-        /* Extend the existing region to include the new page.
-           This is a compromise between unnecessary flushes and
-           the cost of maintaining a full variable size TLB.  */
-        lp_mask &= env_tlb(env)->d[mmu_idx].large_page_mask;
-        while (((lp_addr ^ vaddr) & lp_mask) != 0) {
-            lp_mask <<= 1;
-        }
-    }
-    env_tlb(env)->d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
-}
-
 /*
  * Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
@@ -1316,6 +1414,7 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
 static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
                      MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
 {
+    CPUTLBCommon *c = &env_tlb(cpu->env_ptr)->c;
     bool ok;
 
     /*
@@ -1325,6 +1424,7 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
     ok = cpu->cc->tcg_ops->tlb_fill(cpu, addr, size,
                                     access_type, mmu_idx, false, retaddr);
     assert(ok);
+    qatomic_set(&c->fill_count, c->fill_count + 1);
 }
 
 static inline void cpu_unaligned_access(CPUState *cpu, vaddr addr,
@@ -1468,6 +1568,9 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUTLBEntryFull *f2 = &env_tlb(env)->d[mmu_idx].vfulltlb[vidx];
             CPUTLBEntryFull tmpf;
             tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+
+            qatomic_set(&env_tlb(env)->c.victim_hit_count,
+                        env_tlb(env)->c.victim_hit_count + 1);
             return true;
         }
     }
@@ -1521,6 +1624,8 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
                 *pfull = NULL;
                 return TLB_INVALID_MASK;
             }
+            qatomic_set(&env_tlb(env)->c.fill_count,
+                        env_tlb(env)->c.fill_count + 1);
 
             /* TLB resize via tlb_fill may have moved the entry.  */
             index = tlb_index(env, mmu_idx, addr);
@@ -934,6 +934,84 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
 }
 
+static gboolean tb_evict_one(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+
+    if (tb_page_addr0(tb) != -1) {
+        tb_phys_invalidate(tb, -1);
+        return false;
+    }
+
+    /*
+     * One-shot TBs are not hashed, but they can still be chained, and
+     * cpu_exec() puts them in the jump cache like any other TB.
+     */
+    qemu_spin_lock(&tb->jmp_lock);
+    qatomic_set(&tb->cflags, tb->cflags | CF_INVALID);
+    qemu_spin_unlock(&tb->jmp_lock);
+    tb_jmp_cache_inval_tb(tb);
+    tb_remove_from_jmp_list(tb, 0);
+    tb_remove_from_jmp_list(tb, 1);
+    tb_jmp_unlink(tb);
+    return false;
+}
+
+static unsigned tb_reclaim_gen(void)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count) +
+           qatomic_read(&tb_ctx.tb_evict_count);
+}
+
+/* evict the oldest translation blocks, or flush them all if we cannot */
+static void do_tb_reclaim(CPUState *cpu, run_on_cpu_data gen)
+{
+    size_t n = 0;
+
+    mmap_lock();
+    /* If it is already been done on request of another CPU, just retry. */
+    if (tb_reclaim_gen() != gen.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    /*
+     * Plugins keep per-TB instrumentation data that is released only by
+     * qemu_plugin_flush_cb(), and expect a flush event when TBs go away.
+     */
+    if (bitmap_empty(cpu->plugin_mask, QEMU_PLUGIN_EV_MAX)) {
+        qemu_thread_jit_write();
+        n = tcg_region_evict(tb_evict_one, NULL);
+        qemu_thread_jit_execute();
+    }
+    if (n) {
+        qatomic_inc(&tb_ctx.tb_evict_count);
+    }
+    mmap_unlock();
+
+    if (!n) {
+        do_tb_flush(cpu,
+                    RUN_ON_CPU_HOST_INT(qatomic_read(&tb_ctx.tb_flush_count)));
+    }
+}
+
+/*
+ * Make room in the code buffer once it is full.  Unlike tb_flush(), this
+ * keeps the TBs of the most recently filled regions.
+ */
+void tb_reclaim(CPUState *cpu)
+{
+    if (tcg_enabled()) {
+        unsigned gen = tb_reclaim_gen();
+
+        if (cpu_in_serial_context(cpu)) {
+            do_tb_reclaim(cpu, RUN_ON_CPU_HOST_INT(gen));
+        } else {
+            async_safe_run_on_cpu(cpu, do_tb_reclaim, RUN_ON_CPU_HOST_INT(gen));
+        }
+    }
+}
+
 /*
  * Add a new TB and link it to the physical page tables. phys_page2 is
  * (-1) to indicate that only one page contains the TB.
@@ -26,6 +26,7 @@
 #define CPUINFO_AVX512VBMI2     (1u << 15)
 #define CPUINFO_ATOMIC_VMOVDQA  (1u << 16)
 #define CPUINFO_ATOMIC_VMOVDQU  (1u << 17)
+#define CPUINFO_AVX512VPOPCNTDQ (1u << 18)
 
 /* Initialized with a constructor. */
 extern unsigned cpuinfo;
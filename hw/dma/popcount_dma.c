@@ -20,156 +20,246 @@
 #include "hw/sysbus.h"
 #include "chardev/char.h"
 #include "exec/cpu-common.h"
+#include "exec/address-spaces.h"
 #include "hw/hw.h"
 #include "hw/irq.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "qemu/module.h"
 #include "hw/dma/popcount_dma.h"
 
-#define REG_MM2S_DMACR    0x0
-#define REG_MM2S_DMASR    0x4
-#define REG_MM2S_SA       0x18
-#define REG_MM2S_LENGTH   0x28
+#define PDMA_MMIO_SIZE    0x1000
 
+/* Bounce chunk for the stream, so a transfer never sits wholly on the stack */
+#define DMA_CHUNK_SIZE    4096
 
-/* Read Callback for the popcount function */
-static uint64_t MM2S_DMACR_read(void *opaque, hwaddr addr, unsigned int size)
+static void pdma_update_irq(pdmaState *s)
 {
-    /* Aquiring state */
-    //pdmaState *s = opaque;
-     
-    /* Log guest error for debugging */
-    qemu_log_mask(LOG_GUEST_ERROR, "%s: read: addr=0x%x size=%d\n",
-                  __func__, (int)addr,size);
-
-    /* Return the current bitcount */
-    //return s->CR_reg;
-    return 0x0;
+    qemu_set_irq(s->irq, !!(s->SR_reg & s->CR_reg & DMASR_IRQ_MASK));
 }
 
-/* Write callback for main popcount function */
-static void MM2S_DMACR_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size)
+static void pdma_reset(pdmaState *s)
 {
-    pdmaState *s = opaque;
-    uint32_t value = val64; /*this line is for full correctness - uint32_t*/
-    //(void)s;
-    s->CR_reg=value;
-    qemu_log_mask(LOG_GUEST_ERROR, "Wrote: %x to %x", value, (int)addr);
+    s->CR_reg = DMACR_RESET_VALUE;
+    s->SR_reg = DMASR_RESET_VALUE;
+    pdma_update_irq(s);
 }
 
-static uint64_t MM2S_DMASR_read(void *opaque, hwaddr addr, unsigned int size)
+static void MM2S_DMACR_write(pdmaState *s, uint32_t value)
 {
-  return (uint64_t)65;
+    if (value & R_MM2S_DMACR_RESET_MASK) {
+        pdma_reset(s);
+        return;
+    }
+
+    s->CR_reg = value;
+    if (value & R_MM2S_DMACR_RS_MASK) {
+        s->SR_reg &= ~R_MM2S_DMASR_HALTED_MASK;
+    } else {
+        s->SR_reg |= R_MM2S_DMASR_HALTED_MASK;
+    }
+    pdma_update_irq(s);
 }
-static void MM2S_DMASR_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size)
+
+/*
+ * The stream sink is another device's MMIO register, so unlike the
+ * popcount engine this transfer cannot leave the vCPU thread: it
+ * completes before the LENGTH write returns.
+ */
+static void MM2S_LENGTH_write(pdmaState *s, uint32_t value)
 {
-  return;
+    hwaddr src = s->SA_reg;
+    hwaddr len;
+    MemTxResult res = MEMTX_OK;
+
+    // 31-26 are reserved bits! see:
+    // https://docs.xilinx.com/r/en-US/pg021_axi_dma/MM2S_LENGTH-MM2S-DMA-Transfer-Length-Register-Offset-28h
+    value &= R_MM2S_LENGTH_LENGTH_MASK;
+    len = value & ~3u;
+
+    if (s->SR_reg & R_MM2S_DMASR_HALTED_MASK) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: MM2S channel is halted\n",
+                      __func__);
+        return;
+    }
+
+    s->LEN_reg = value;
+    if (!value) {
+        return;
+    }
+    s->SR_reg &= ~R_MM2S_DMASR_IDLE_MASK;
+
+    while (len && res == MEMTX_OK) {
+        uint32_t buffer[DMA_CHUNK_SIZE / 4];
+        hwaddr chunk = MIN(len, sizeof(buffer));
+
+        res = address_space_read(&address_space_memory, src,
+                                 MEMTXATTRS_UNSPECIFIED, buffer, chunk);
+        for (int i = 0; i < chunk / 4 && res == MEMTX_OK; i++) {
+            res = address_space_write(&address_space_memory, s->dest,
+                                      MEMTXATTRS_UNSPECIFIED, &buffer[i], 4);
+        }
+        src += chunk;
+        len -= chunk;
+    }
+
+    if (res != MEMTX_OK) {
+        s->SR_reg |= R_MM2S_DMASR_DMA_SLV_ERR_MASK |
+                     R_MM2S_DMASR_ERR_IRQ_MASK | R_MM2S_DMASR_HALTED_MASK;
+        s->CR_reg &= ~R_MM2S_DMACR_RS_MASK;
+    } else {
+        s->SR_reg |= R_MM2S_DMASR_IDLE_MASK | R_MM2S_DMASR_IOC_IRQ_MASK;
+    }
+    pdma_update_irq(s);
 }
 
-static uint64_t MM2S_DMA_SA_read(void *opaque, hwaddr addr, unsigned int size)
+static uint64_t pdma_read(void *opaque, hwaddr addr, unsigned int size)
 {
-  // 32 bit source address register - read.
-  pdmaState *s = opaque;
-  return (uint64_t) s->SA_reg;
+    pdmaState *s = opaque;
+
+    switch (addr) {
+    case A_MM2S_DMACR:
+        return s->CR_reg;
+    case A_MM2S_DMASR:
+        return s->SR_reg;
+    case A_MM2S_SA:
+        return s->SA_reg;
+    case A_MM2S_SA_MSB:
+        return 0;
+    case A_MM2S_LENGTH:
+        return s->LEN_reg;
+    case A_MM2S_CURDESC ... A_MM2S_TAILDESC_MSB:
+        qemu_log_mask(LOG_UNIMP, "%s: scatter-gather mode not implemented\n",
+                      __func__);
+        return 0;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        return 0;
+    }
 }
-static void MM2S_DMA_SA_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size)
+
+static void pdma_write(void *opaque, hwaddr addr, uint64_t val64,
+                       unsigned int size)
 {
-  // 32 bit source address register - write.
-  pdmaState *s = opaque;
-  uint32_t value = val64;
-  s->SA_reg = value;
+    pdmaState *s = opaque;
+    uint32_t value = val64;
+
+    switch (addr) {
+    case A_MM2S_DMACR:
+        MM2S_DMACR_write(s, value);
+        break;
+    case A_MM2S_DMASR:
+        /* Only the interrupt bits are writable, and are write-1-to-clear */
+        s->SR_reg &= ~(value & DMASR_IRQ_MASK);
+        pdma_update_irq(s);
+        break;
+    case A_MM2S_SA:
+        s->SA_reg = value;
+        break;
+    case A_MM2S_SA_MSB:
+        if (value) {
+            qemu_log_mask(LOG_UNIMP, "%s: 64-bit MM2S_SA not supported\n",
+                          __func__);
+        }
+        break;
+    case A_MM2S_LENGTH:
+        MM2S_LENGTH_write(s, value);
+        break;
+    case A_MM2S_CURDESC ... A_MM2S_TAILDESC_MSB:
+        qemu_log_mask(LOG_UNIMP, "%s: scatter-gather mode not implemented\n",
+                      __func__);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
 }
 
-static uint64_t MM2S_LENGTH_read(void *opaque, hwaddr addr, unsigned int size)
+static const MemoryRegionOps pdma_ops = {
+    .read = pdma_read,
+    .write = pdma_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+    .impl = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+};
+
+DeviceState *pdma_create(hwaddr addr, hwaddr dest, qemu_irq irq)
 {
-  pdmaState *s = opaque;
-  return (uint64_t) s->VALUE;
+    DeviceState *dev;
+    SysBusDevice *s;
+
+    dev = qdev_new(TYPE_PDMA);
+    s = SYS_BUS_DEVICE(dev);
+    qdev_prop_set_uint64(dev, "dest", dest);
+    sysbus_realize_and_unref(s, &error_fatal);
+    sysbus_mmio_map(s, 0, addr);
+    sysbus_connect_irq(s, 0, irq);
+
+    return dev;
 }
 
-static void MM2S_LENGTH_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size)
+static const VMStateDescription vmstate_pdma = {
+    .name = TYPE_PDMA,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT64(CR_reg, pdmaState),
+        VMSTATE_UINT32(SR_reg, pdmaState),
+        VMSTATE_UINT32(SA_reg, pdmaState),
+        VMSTATE_UINT32(LEN_reg, pdmaState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property pdma_properties[] = {
+    DEFINE_PROP_UINT64("dest", pdmaState, dest, 0),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void pdma_init(Object *obj)
 {
-  pdmaState *s = opaque;
-  // 31-26 are reserved bits! see:
-  // https://docs.xilinx.com/r/en-US/pg021_axi_dma/MM2S_LENGTH-MM2S-DMA-Transfer-Length-Register-Offset-28h
-  uint32_t value = val64 & 0x3FFFFFF;
-  //uint32_t buffer[8]; // No idea how this works, but for some reason it does...
-    //
-  // set length
-  s->LEN_reg = value;
-  uint32_t buffer[value/4];
-  // DMA Transfer``
-  // cpu_physical_memory_read(hwaddr addr, void* buffer, hwaddr len)
-  // len is number of bytes uint32 = 4 bytes
-  cpu_physical_memory_read(s->SA_reg, &buffer, value);
-  uint32_t *a = buffer;
-  for (int i = 0; i < (int)value/4; i++){
-      cpu_physical_memory_write(0x40000004, a, 4);
-      a++;
-  }
-  //cpu_physical_memory_read(0x40001000, &buffer, 4);
-  //cpu_physical_memory_write(s->SA_reg, &buffer, 4);
-  //s->VALUE = buffer;
-  s->LEN_reg = buffer[0]; 
-  s->start = 1;
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+    pdmaState *s = PDMA(obj);
+
+    memory_region_init_io(&s->iomem, obj, &pdma_ops, s, TYPE_PDMA,
+                          PDMA_MMIO_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+    sysbus_init_irq(sbd, &s->irq);
 }
 
-/* Initializes the write register */
-/*static void write_reg_init(pdmaState *s){
-  return;
-}*/
+static void pdma_qdev_reset(DeviceState *dev)
+{
+    pdma_reset(PDMA(dev));
+}
 
-/* Memory operation binding for popcount region */
-static const MemoryRegionOps DMACR_ops = {
-    .read = MM2S_DMACR_read,
-    .write = MM2S_DMACR_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-    .valid = {
-        .min_access_size = 1*sizeof(int),
-        .max_access_size = 64*sizeof(int)}
-};
+static void pdma_class_init(ObjectClass *oc, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(oc);
 
-/* Memory operation binding for reset region */
-static const MemoryRegionOps DMASR_ops = {
-    .read = MM2S_DMASR_read,
-    .write = MM2S_DMASR_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-    .valid = {
-        .min_access_size = 1,
-        .max_access_size = 64}
-};
+    dc->reset = pdma_qdev_reset;
+    dc->vmsd = &vmstate_pdma;
+    device_class_set_props(dc, pdma_properties);
+}
 
-/* Memory operation binding for reset region */
-static const MemoryRegionOps DMASA_ops = {
-    .read = MM2S_DMA_SA_read,
-    .write = MM2S_DMA_SA_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-    .valid = {
-        .min_access_size = 1,
-        .max_access_size = 64}
+static const TypeInfo pdma_info = {
+    .name          = TYPE_PDMA,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(pdmaState),
+    .instance_init = pdma_init,
+    .class_init    = pdma_class_init,
 };
 
-/* Memory operation binding for reset region */
-static const MemoryRegionOps DMALEN_ops = {
-    .read = MM2S_LENGTH_read,
-    .write = MM2S_LENGTH_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-    .valid = {
-        .min_access_size = 1,
-        .max_access_size = 64}
-};
-/* Initialization of the popcount hardware DEVICE_NATIVE_ENDIAN
- * May be desirable to make this of type void in the future to match 
- * QEMU hw device protocol more typically
- */
-pdmaState *pdma_create(MemoryRegion *address_space, hwaddr base)
+static void pdma_register_types(void)
 {
-    pdmaState *s = g_malloc0(sizeof(pdmaState));
-    //write_reg_init(s);
-    memory_region_init_io(&s->MM2S_DMACR, NULL, &DMACR_ops, s, TYPE_PDMA, 32);
-    memory_region_init_io(&s->MM2S_DMASR, NULL, &DMASR_ops, s, TYPE_PDMA, 32);
-    memory_region_init_io(&s->MM2S_SA, NULL, &DMASA_ops, s, TYPE_PDMA, 32);
-    memory_region_init_io(&s->MM2S_LENGTH, NULL, &DMALEN_ops, s, TYPE_PDMA, 32);
-    memory_region_add_subregion(address_space, base, &s->MM2S_DMACR);
-    memory_region_add_subregion(address_space, base+4, &s->MM2S_DMASR);
-    memory_region_add_subregion(address_space, base+0x18, &s->MM2S_SA);
-    memory_region_add_subregion(address_space, base+0x28, &s->MM2S_LENGTH);
-    return s;
+    type_register_static(&pdma_info);
 }
+
+type_init(pdma_register_types)
@@ -17,228 +17,1113 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/log.h"
+#include "qemu/bitops.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/crc32c.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "qemu/main-loop.h"
 #include "hw/sysbus.h"
 #include "chardev/char.h"
+#include "exec/address-spaces.h"
+#include "block/thread-pool.h"
+#include "qemu/iov.h"
 #include "hw/hw.h"
 #include "hw/irq.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "sysemu/runstate.h"
+#include "qemu/module.h"
 #include "hw/popcount/popcount.h"
+#include "hw/dma/popcount_dma.h"
+#include "trace.h"
 
 
+/* Popcount core registers; the AXI DMA block follows at DMA_OFFSET */
+REG32(POP_RESET, 0x0)
+REG32(POP_DATA, 0x4)
+
 #define DMA_OFFSET        0x1000
-#define REG_MM2S_DMACR    0x0 + DMA_OFFSET
-#define REG_MM2S_DMASR    0x4 + DMA_OFFSET
-#define REG_MM2S_SA       0x18 + DMA_OFFSET
-#define REG_MM2S_LENGTH   0x28 + DMA_OFFSET
+#define POPCOUNT_MMIO_SIZE 0x10000
+
+/* Bounce chunk for sources that cannot be mapped in place (e.g. MMIO) */
+#define DMA_CHUNK_SIZE    4096
 
-#define MMIO_DELAY        1000
+/* Descriptors fetched and mapped per worker submission */
+#define SG_BATCH_MAX      256
+
+/*
+ * Reduce kernels.  The core folds the 32-bit little-endian words of the
+ * stream into a 32-bit accumulator; POP_DATA reads back result(acc).
+ * @update may be handed any number of whole words at a time, so the word
+ * loops are left for the compiler to vectorize.
+ */
+struct PopcountKernel {
+    const char *name;
+    uint32_t init;
+    uint32_t (*update)(uint32_t acc, const uint8_t *buf, size_t len);
+    uint32_t (*result)(uint32_t acc);
+};
 
-/* Read Callback for the popcount function */
-static uint64_t pop_read(void *opaque, hwaddr addr, unsigned int size)
+static uint32_t kernel_popcount(uint32_t acc, const uint8_t *buf, size_t len)
 {
-    /* Aquiring state */
-    popState *s = opaque;
+    return acc + buffer_popcount(buf, len);
+}
+
+/*
+ * @acc is the raw CRC register: crc32c() hands back the register inverted,
+ * so undo that here and only finalize in kernel_crc32c_result().  That way
+ * the value does not depend on how the stream is split into chunks.
+ */
+static uint32_t kernel_crc32c(uint32_t acc, const uint8_t *buf, size_t len)
+{
+    return ~crc32c(acc, buf, len);
+}
+
+static uint32_t kernel_crc32c_result(uint32_t acc)
+{
+    return ~acc;
+}
+
+static uint32_t kernel_sum(uint32_t acc, const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i += 4) {
+        acc += ldl_le_p(buf + i);
+    }
+    return acc;
+}
 
-    /* Log guest error for debugging */
-    qemu_log_mask(LOG_GUEST_ERROR, "%s: read: addr=0x%x size=%d\n",
-                  __func__, (int)addr,size);
+static uint32_t kernel_xor(uint32_t acc, const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i += 4) {
+        acc ^= ldl_le_p(buf + i);
+    }
+    return acc;
+}
 
-    /* Return the current bitcount */
-    return s->bitcount;
+static uint32_t kernel_min(uint32_t acc, const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i += 4) {
+        acc = MIN(acc, ldl_le_p(buf + i));
+    }
+    return acc;
 }
 
-/* Actual popcount computation */
-static uint32_t popcount(uint32_t val){
-    uint32_t count;
-    for (count=0; val; count++){
-        val &= val - 1;
+static uint32_t kernel_max(uint32_t acc, const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i += 4) {
+        acc = MAX(acc, ldl_le_p(buf + i));
     }
-    return count; 
+    return acc;
+}
+
+/* The first entry is the default */
+static const PopcountKernel popcount_kernels[] = {
+    { "popcount", 0,          kernel_popcount },
+    { "crc32c",   UINT32_MAX, kernel_crc32c, kernel_crc32c_result },
+    { "sum",      0,          kernel_sum },
+    { "xor",      0,          kernel_xor },
+    { "min",      UINT32_MAX, kernel_min },
+    { "max",      0,          kernel_max },
+};
+
+static uint32_t kernel_result(const PopcountKernel *k, uint32_t acc)
+{
+    return k->result ? k->result(acc) : acc;
+}
+
+static const PopcountKernel *popcount_find_kernel(const char *name)
+{
+    for (unsigned i = 0; i < ARRAY_SIZE(popcount_kernels); i++) {
+        if (!strcmp(popcount_kernels[i].name, name)) {
+            return &popcount_kernels[i];
+        }
+    }
+    return NULL;
 }
 
 /* Write callback for main popcount function */
-static void pop_write_low(void *opaque, hwaddr addr, uint64_t val64, unsigned int size)
+static void pop_write(popState *s, uint32_t value)
 {
-    popState *s = opaque;
-    uint32_t value = val64; /*this line is for full correctness - uint32_t*/
-    (void)s;
+    uint8_t word[4];
 
+    if (s->dma_req) {
+        /* The core takes its stream from one port at a time */
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: data written during MM2S "
+                      "transfer\n", __func__);
+        return;
+    }
     s->write_reg = value;
-    s->bitcount += popcount(value);
+    stl_le_p(word, value);
+    s->acc = s->kernel->update(s->acc, word, sizeof(word));
+}
+
+struct PopcountDMAReq {
+    popState *s;
+    QEMUIOVector qiov;    /* guest RAM mapped for the worker thread */
+    GArray *bounced;      /* bool per iov entry: copied out, not mapped */
+    hwaddr addr;
+    uint32_t len;
+    uint32_t acc;         /* the core's accumulator, carried through */
+    uint32_t fill;        /* stream bytes into the current result block */
+    uint32_t *out;        /* results for S2MM, little-endian */
+    unsigned nout;
+    uint32_t err;         /* DMASR error bits, if the transfer failed */
+    int64_t start;
+    int64_t deadline;     /* QEMU_CLOCK_VIRTUAL time the transfer completes */
+    bool done;            /* worker finished, waiting for the deadline */
+
+    /* Scatter-gather mode: the descriptors this request covers */
+    bool sg;
+    unsigned ndescs;
+    uint64_t desc[SG_BATCH_MAX];
+    uint32_t desc_ctrl[SG_BATCH_MAX];
+    uint32_t desc_status;  /* error status for the last descriptor */
+    uint64_t next;         /* NXTDESC of the last descriptor */
+};
+
+static unsigned dma_irq_threshold(popState *s)
+{
+    /* A threshold of zero is not valid and behaves like one */
+    return MAX(FIELD_EX32(s->CR_reg, MM2S_DMACR, IRQ_THRESHOLD), 1);
+}
+
+/* Both channels share the one interrupt line of the device */
+static void dma_update_irq(popState *s)
+{
+    s->SR_reg = FIELD_DP32(s->SR_reg, MM2S_DMASR, IRQ_THRESHOLD_STS,
+                           s->irq_count);
+    qemu_set_irq(s->irq, (s->SR_reg & s->CR_reg & DMASR_IRQ_MASK) ||
+                         (s->s2mm_sr & s->s2mm_cr & DMASR_IRQ_MASK));
+}
+
+static void dma_req_free(PopcountDMAReq *req)
+{
+    g_free(req->out);
+    g_free(req);
+}
+
+/* A soft reset through either channel resets the whole DMA engine */
+static void dma_reset(popState *s)
+{
+    /* A transfer still running on the worker is discarded on completion */
+    if (s->dma_req && s->dma_req->done) {
+        dma_req_free(s->dma_req);
+    }
+    s->dma_req = NULL;
+    s->dma_inflight = DMA_INFLIGHT_NONE;
+    if (s->dma_timer) {
+        timer_del(s->dma_timer);
+    }
+    s->CR_reg = DMACR_RESET_VALUE;
+    s->SR_reg = DMASR_RESET_VALUE | R_MM2S_DMASR_SG_INCLD_MASK;
+    s->curdesc = 0;
+    s->taildesc = 0;
+    s->sg_next = 0;
+    s->irq_count = dma_irq_threshold(s);
+    s->s2mm_cr = DMACR_RESET_VALUE;
+    s->s2mm_sr = DMASR_RESET_VALUE;
+    s->s2mm_da = 0;
+    s->s2mm_len = 0;
+    s->s2mm_done = 0;
+    s->s2mm_busy = false;
+    dma_update_irq(s);
+}
+
+static void dma_cr_write(popState *s, uint32_t value)
+{
+    if (value & R_MM2S_DMACR_RESET_MASK) {
+        dma_reset(s);
+        return;
+    }
+
+    s->CR_reg = value;
+    s->irq_count = dma_irq_threshold(s);
+    if (value & R_MM2S_DMACR_RS_MASK) {
+        s->SR_reg &= ~R_MM2S_DMASR_HALTED_MASK;
+    } else if (!s->dma_req) {
+        /* Otherwise the channel halts once the current transfer is done */
+        s->SR_reg |= R_MM2S_DMASR_HALTED_MASK;
+    }
+    dma_update_irq(s);
+}
+
+static void dma_sr_write(popState *s, uint32_t value)
+{
+    /* Only the interrupt bits are writable, and they are write-1-to-clear */
+    s->SR_reg &= ~(value & DMASR_IRQ_MASK);
+    dma_update_irq(s);
+}
+
+static void s2mm_cr_write(popState *s, uint32_t value)
+{
+    if (value & R_MM2S_DMACR_RESET_MASK) {
+        dma_reset(s);
+        return;
+    }
+
+    s->s2mm_cr = value;
+    if (value & R_MM2S_DMACR_RS_MASK) {
+        s->s2mm_sr &= ~R_MM2S_DMASR_HALTED_MASK;
+    } else {
+        /* An armed buffer is abandoned */
+        s->s2mm_sr |= R_MM2S_DMASR_HALTED_MASK;
+        s->s2mm_busy = false;
+    }
+    dma_update_irq(s);
+}
+
+static void s2mm_sr_write(popState *s, uint32_t value)
+{
+    s->s2mm_sr &= ~(value & DMASR_IRQ_MASK);
+    dma_update_irq(s);
+}
+
+static void s2mm_length_write(popState *s, uint32_t value)
+{
+    value &= R_S2MM_LENGTH_LENGTH_MASK;
+
+    if (s->s2mm_sr & R_MM2S_DMASR_HALTED_MASK) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: S2MM channel is halted\n",
+                      __func__);
+        return;
+    }
+    if (s->s2mm_busy) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: S2MM transfer already armed\n",
+                      __func__);
+        return;
+    }
+
+    s->s2mm_len = value;
+    if (!value) {
+        return;
+    }
+    s->s2mm_done = 0;
+    s->s2mm_busy = true;
+    s->s2mm_sr &= ~R_MM2S_DMASR_IDLE_MASK;
+}
+
+/*
+ * Copy results into guest memory.  Going through address_space_map()
+ * rather than a store per word means a large result array costs one
+ * memcpy per contiguous run; unmapping marks the pages dirty for
+ * migration and drops any translated code they held.
+ */
+static bool s2mm_write(hwaddr addr, const void *buf, hwaddr len)
+{
+    AddressSpace *as = &address_space_memory;
+
+    while (len) {
+        hwaddr plen = len;
+        void *p = address_space_map(as, addr, &plen, true,
+                                    MEMTXATTRS_UNSPECIFIED);
+
+        if (!p) {
+            return address_space_write(as, addr, MEMTXATTRS_UNSPECIFIED,
+                                       buf, len) == MEMTX_OK;
+        }
+        memcpy(p, buf, plen);
+        address_space_unmap(as, p, plen, true, plen);
+        addr += plen;
+        buf += plen;
+        len -= plen;
+    }
+    return true;
+}
+
+/*
+ * Hand the results of a finished MM2S request to the S2MM channel.
+ * @last marks the end of the packet (TLAST), which completes the buffer.
+ * Results are simply dropped while the S2MM channel is not running, as
+ * a driver that only reads POP_DATA never starts it.
+ */
+static void s2mm_push(popState *s, PopcountDMAReq *req, bool last)
+{
+    uint32_t len = req->nout * sizeof(uint32_t);
+
+    if (!(s->s2mm_cr & R_MM2S_DMACR_RS_MASK)) {
+        return;
+    }
+    if (!s->s2mm_busy) {
+        if (len) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: S2MM not armed, %u result "
+                          "bytes dropped\n", __func__, len);
+        }
+        return;
+    }
+
+    if (len > s->s2mm_len - s->s2mm_done) {
+        /* The packet does not fit the buffer */
+        s->s2mm_sr |= R_MM2S_DMASR_DMA_INT_ERR_MASK;
+    } else if (!s2mm_write(s->s2mm_da + s->s2mm_done, req->out, len)) {
+        s->s2mm_sr |= R_MM2S_DMASR_DMA_SLV_ERR_MASK;
+    } else {
+        s->s2mm_done += len;
+        if (last) {
+            trace_popcount_s2mm_transfer(s->s2mm_da, s->s2mm_done);
+            s->s2mm_len = s->s2mm_done;
+            s->s2mm_busy = false;
+            s->s2mm_sr |= R_MM2S_DMASR_IOC_IRQ_MASK |
+                          R_MM2S_DMASR_IDLE_MASK;
+        }
+        return;
+    }
+    s->s2mm_sr |= R_MM2S_DMASR_ERR_IRQ_MASK | R_MM2S_DMASR_HALTED_MASK;
+    s->s2mm_cr &= ~R_MM2S_DMACR_RS_MASK;
+    s->s2mm_busy = false;
+}
+
+/*
+ * Map a source buffer for the worker thread.  RAM is handed over in
+ * place; whatever address_space_map() cannot give out directly is read
+ * into a bounce buffer here, while we still hold the BQL, so that the
+ * kernel still sees the stream in order.
+ */
+static bool dma_map(PopcountDMAReq *req, hwaddr addr, hwaddr len)
+{
+    AddressSpace *as = &address_space_memory;
+
+    /*
+     * The stream is consumed one 32-bit word at a time; a trailing partial
+     * word never reaches the counter.
+     */
+    len &= ~(hwaddr)3;
+
+    while (len) {
+        hwaddr plen = len;
+        void *p = address_space_map(as, addr, &plen, false,
+                                    MEMTXATTRS_UNSPECIFIED);
+        bool bounce = !p;
+
+        if (bounce) {
+            plen = MIN(len, DMA_CHUNK_SIZE);
+            p = g_malloc(plen);
+            if (address_space_read(as, addr, MEMTXATTRS_UNSPECIFIED,
+                                   p, plen) != MEMTX_OK) {
+                g_free(p);
+                req->err = R_MM2S_DMASR_DMA_SLV_ERR_MASK;
+                return false;
+            }
+        }
+        qemu_iovec_add(&req->qiov, p, plen);
+        g_array_append_val(req->bounced, bounce);
+        addr += plen;
+        len -= plen;
+    }
+    return true;
+}
+
+/*
+ * Fetch descriptors from @desc onwards and map their buffers, stopping
+ * after the tail descriptor or once a batch is full.  The remainder of
+ * a longer chain is picked up when this batch completes.
+ */
+static void dma_sg_map(popState *s, PopcountDMAReq *req, uint64_t desc)
+{
+    for (;;) {
+        uint8_t d[SG_DESC_SIZE];
+        uint32_t ctrl;
+
+        if (address_space_read(&address_space_memory, desc,
+                               MEMTXATTRS_UNSPECIFIED, d, sizeof(d))
+            != MEMTX_OK) {
+            req->err = R_MM2S_DMASR_SG_SLV_ERR_MASK;
+            return;
+        }
+        if (ldl_le_p(d + SG_DESC_STATUS) & SG_STS_CMPLT) {
+            /* The driver has not recycled this descriptor yet */
+            req->err = R_MM2S_DMASR_SG_INT_ERR_MASK;
+            return;
+        }
+
+        ctrl = ldl_le_p(d + SG_DESC_CONTROL);
+        req->desc[req->ndescs] = desc;
+        req->desc_ctrl[req->ndescs] = ctrl;
+        req->ndescs++;
+        req->len += ctrl & SG_CTRL_LENGTH_MASK;
+        req->next = ldq_le_p(d + SG_DESC_NXTDESC);
+
+        if (!dma_map(req, ldq_le_p(d + SG_DESC_BUFFER_ADDRESS),
+                     ctrl & SG_CTRL_LENGTH_MASK)) {
+            req->desc_status = SG_STS_DMA_SLV_ERR;
+            return;
+        }
+        if (desc == s->taildesc || req->ndescs == SG_BATCH_MAX) {
+            return;
+        }
+        desc = req->next;
+    }
+}
+
+/* Emit the result so far; in block mode the next block starts afresh */
+static void dma_emit(PopcountDMAReq *req, bool restart)
+{
+    const PopcountKernel *k = req->s->kernel;
+
+    req->out[req->nout++] = cpu_to_le32(kernel_result(k, req->acc));
+    if (restart) {
+        req->acc = k->init;
+        req->fill = 0;
+    }
+}
+
+/* Feed whole words to the kernel, cutting at result block boundaries */
+static void dma_feed(PopcountDMAReq *req, const uint8_t *p, size_t len)
+{
+    const PopcountKernel *k = req->s->kernel;
+    uint32_t block = req->s->block_size;
+
+    if (!block) {
+        req->acc = k->update(req->acc, p, len);
+        return;
+    }
+    while (len) {
+        size_t n = MIN(len, block - req->fill);
+
+        req->acc = k->update(req->acc, p, n);
+        req->fill += n;
+        p += n;
+        len -= n;
+        if (req->fill == block) {
+            dma_emit(req, true);
+        }
+    }
+}
+
+/*
+ * Runs on a thread pool worker, without the BQL.  Mappings can end in
+ * the middle of a word; the pieces are put back together before they
+ * reach the kernel.
+ */
+static int dma_popcount_worker(void *opaque)
+{
+    PopcountDMAReq *req = opaque;
+    uint8_t word[4];
+    size_t n = 0;
 
-    qemu_log_mask(LOG_GUEST_ERROR, "Wrote: %x to %x", value, (int)addr);
+    for (int i = 0; i < req->qiov.niov; i++) {
+        const uint8_t *p = req->qiov.iov[i].iov_base;
+        size_t len = req->qiov.iov[i].iov_len;
+
+        if (n) {
+            size_t fill = MIN(len, sizeof(word) - n);
+
+            memcpy(word + n, p, fill);
+            n += fill;
+            p += fill;
+            len -= fill;
+            if (n < sizeof(word)) {
+                continue;
+            }
+            dma_feed(req, word, sizeof(word));
+            n = 0;
+        }
+        dma_feed(req, p, len & ~3);
+        n = len & 3;
+        memcpy(word, p + (len & ~3), n);
+    }
+    return 0;
 }
 
-static void pop_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size)
+static void dma_popcount_complete(void *opaque, int ret);
+
+static PopcountDMAReq *dma_req_new(popState *s)
 {
-    for(int i = 0; i < MMIO_DELAY; i++){ 
-        qemu_log_mask(LOG_GUEST_ERROR, "READING RESET IS NOT USEFUL");
+    PopcountDMAReq *req = g_new0(PopcountDMAReq, 1);
+
+    req->s = s;
+    req->acc = s->acc;
+    req->fill = s->block_fill;
+    if (trace_event_get_state_backends(TRACE_POPCOUNT_DMA_TRANSFER)) {
+        req->start = get_clock();
     }
-    pop_write_low(opaque, addr, val64, size);
+    qemu_iovec_init(&req->qiov, 1);
+    req->bounced = g_array_new(false, false, sizeof(bool));
+    return req;
 }
 
-static uint64_t dma_cr_read(void *opaque, hwaddr addr, unsigned int size){
-  //popState *s = opaque;
-  //return s->CR_reg;
-  return 0x0;
+/*
+ * Charge the modelled accelerator time for this request to the virtual
+ * clock.  Under icount that clock follows the guest's instruction count,
+ * so the guest sees the same throughput however fast the host is.
+ */
+static int64_t dma_deadline(popState *s, PopcountDMAReq *req)
+{
+    uint64_t ns = (uint64_t)(req->len / 4) * s->word_latency_ns +
+                  MAX(req->ndescs, 1) * s->transfer_latency_ns;
+
+    return ns ? qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + ns : 0;
 }
-static uint64_t dma_sr_read(void *opaque, hwaddr addr, unsigned int size){
-  //popState *s = opaque;
-  //return s->SR_reg;
-  return 0x2;
 
+static void dma_submit(popState *s, PopcountDMAReq *req)
+{
+    if (!req->deadline) {
+        req->deadline = dma_deadline(s, req);
+    }
+    /* Room for every block the stream completes, plus the final flush */
+    req->out = g_new(uint32_t, s->block_size ?
+                     (req->fill + req->len) / s->block_size + 1 : 1);
+    s->dma_req = req;
+    s->SR_reg &= ~R_MM2S_DMASR_IDLE_MASK;
+    thread_pool_submit_aio(dma_popcount_worker, req,
+                           dma_popcount_complete, req);
 }
-static uint64_t dma_sa_read(void *opaque, hwaddr addr, unsigned int size){
-  popState *s = opaque;
-  return s->SA_reg;
 
+static void dma_sg_start(popState *s, uint64_t desc)
+{
+    PopcountDMAReq *req = dma_req_new(s);
+
+    req->sg = true;
+    req->addr = desc;
+    dma_sg_map(s, req, desc);
+    dma_submit(s, req);
 }
-static uint64_t dma_len_read(void *opaque, hwaddr addr, unsigned int size){
-  popState *s = opaque;
-  return s->LEN_reg;
+
+/*
+ * Write back descriptor status and count completed packets towards the
+ * interrupt threshold, so that a batch raises one IOC interrupt per
+ * IRQThreshold packets rather than one per buffer.  Returns true if the
+ * channel should go on with the rest of the chain.
+ */
+static bool dma_sg_complete(popState *s, PopcountDMAReq *req)
+{
+    unsigned threshold = dma_irq_threshold(s);
+
+    for (unsigned i = 0; i < req->ndescs; i++) {
+        uint32_t ctrl = req->desc_ctrl[i];
+
+        address_space_stl_le(&address_space_memory,
+                             req->desc[i] + SG_DESC_STATUS,
+                             (ctrl & SG_CTRL_LENGTH_MASK) | SG_STS_CMPLT,
+                             MEMTXATTRS_UNSPECIFIED, NULL);
+        if ((ctrl & SG_CTRL_TXEOF) && --s->irq_count == 0) {
+            s->SR_reg |= R_MM2S_DMASR_IOC_IRQ_MASK;
+            s->irq_count = threshold;
+        }
+    }
+    s->curdesc = req->desc[req->ndescs - 1];
+    s->sg_next = req->next;
+
+    if (s->curdesc != s->taildesc && (s->CR_reg & R_MM2S_DMACR_RS_MASK)) {
+        return true;
+    }
+
+    /*
+     * No delay timer is modelled: packets left below the threshold when
+     * the chain runs dry are flushed with a delay interrupt straight away.
+     */
+    if (s->irq_count != threshold &&
+        FIELD_EX32(s->CR_reg, MM2S_DMACR, IRQ_DELAY)) {
+        s->SR_reg |= R_MM2S_DMASR_DLY_IRQ_MASK;
+        s->irq_count = threshold;
+    }
+    return false;
 }
 
-static void dma_cr_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size){
-  popState *s = opaque;
-  uint32_t value = val64;
-  s->CR_reg=value;
+/* Retire @req, which has been counted and whose deadline has passed */
+static void dma_finish(popState *s, PopcountDMAReq *req)
+{
+    bool more = false;
+
+    s->dma_req = NULL;
+    if (req->err) {
+        /* The whole batch is dropped; only the failing one is marked */
+        if (req->desc_status) {
+            address_space_stl_le(&address_space_memory,
+                                 req->desc[req->ndescs - 1] + SG_DESC_STATUS,
+                                 req->desc_status, MEMTXATTRS_UNSPECIFIED,
+                                 NULL);
+        }
+        s->SR_reg |= req->err | R_MM2S_DMASR_ERR_IRQ_MASK |
+                     R_MM2S_DMASR_HALTED_MASK;
+        s->CR_reg &= ~R_MM2S_DMACR_RS_MASK;
+    } else {
+        if (req->ndescs) {
+            more = dma_sg_complete(s, req);
+        } else {
+            s->SR_reg |= R_MM2S_DMASR_IOC_IRQ_MASK;
+        }
+        if (!more) {
+            /* End of packet: the result, or what is left of a block */
+            if (!s->block_size) {
+                dma_emit(req, false);
+            } else if (req->fill) {
+                dma_emit(req, true);
+            }
+            s->SR_reg |= R_MM2S_DMASR_IDLE_MASK;
+            if (!(s->CR_reg & R_MM2S_DMACR_RS_MASK)) {
+                s->SR_reg |= R_MM2S_DMASR_HALTED_MASK;
+            }
+        }
+        s->acc = req->acc;
+        s->block_fill = req->fill;
+        s2mm_push(s, req, !more);
+    }
+    dma_update_irq(s);
+
+    if (req->start) {
+        int64_t ns = MAX(get_clock() - req->start, 1);
+        trace_popcount_dma_transfer(req->addr, req->len, req->acc, ns,
+                                    (uint64_t)req->len * 1000 / ns);
+    }
+    if (more) {
+        dma_sg_start(s, req->next);
+    }
+    dma_req_free(req);
 }
-static void dma_sr_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size){
-  popState *s = opaque;
-  uint32_t value = val64;
-  s->SR_reg=value;
+
+static void dma_popcount_complete(void *opaque, int ret)
+{
+    PopcountDMAReq *req = opaque;
+    popState *s = req->s;
+
+    for (int i = 0; i < req->qiov.niov; i++) {
+        void *p = req->qiov.iov[i].iov_base;
+
+        if (g_array_index(req->bounced, bool, i)) {
+            g_free(p);
+        } else {
+            address_space_unmap(&address_space_memory, p,
+                                req->qiov.iov[i].iov_len, false,
+                                req->qiov.iov[i].iov_len);
+        }
+    }
+    g_array_free(req->bounced, true);
+    qemu_iovec_destroy(&req->qiov);
+
+    if (s->dma_req != req) {
+        dma_req_free(req);
+        return;
+    }
+
+    req->done = true;
+    if (req->deadline > qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL)) {
+        timer_mod(s->dma_timer, req->deadline);
+    } else {
+        dma_finish(s, req);
+    }
 }
-static void dma_sa_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size){
-  popState *s = opaque;
-  uint32_t value = val64;
-  s->SA_reg = value;
+
+static void dma_timer_cb(void *opaque)
+{
+    popState *s = opaque;
+
+    if (s->dma_req && s->dma_req->done) {
+        dma_finish(s, s->dma_req);
+    }
 }
-static void MM2S_LENGTH_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size)
+
+static void MM2S_LENGTH_write(popState *s, uint32_t value)
 {
-  popState *s = opaque;
+  PopcountDMAReq *req;
+
   // 31-26 are reserved bits! see:
   // https://docs.xilinx.com/r/en-US/pg021_axi_dma/MM2S_LENGTH-MM2S-DMA-Transfer-Length-Register-Offset-28h
-  uint32_t value = val64 & 0x3FFFFFF;
-  //uint32_t buffer[8]; // No idea how this works, but for some reason it does...
-    //
-  // set length
+  value &= R_MM2S_LENGTH_LENGTH_MASK;
+
+  if (s->SR_reg & R_MM2S_DMASR_HALTED_MASK) {
+      qemu_log_mask(LOG_GUEST_ERROR, "%s: MM2S channel is halted\n",
+                    __func__);
+      return;
+  }
+  if (s->dma_req) {
+      qemu_log_mask(LOG_GUEST_ERROR, "%s: MM2S transfer already running\n",
+                    __func__);
+      return;
+  }
+
   s->LEN_reg = value;
-  uint32_t buffer[value/4];
-  // DMA Transfer``
-  // cpu_physical_memory_read(hwaddr addr, void* buffer, hwaddr len)
-  // len is number of bytes uint32 = 4 bytes
-  cpu_physical_memory_read(s->SA_reg, &buffer, value);
-
-  uint32_t *a = buffer;
-  for (int i = 0; i < (int)value/4; i++){
-      //cpu_physical_memory_write(0x40000004, a, 4);
-      pop_write_low(opaque, addr, *a, 4);
-      a++;
+  if (!value) {
+      return;
   }
-  //cpu_physical_memory_read(0x40001000, &buffer, 4);
-  //cpu_physical_memory_write(s->SA_reg, &buffer, 4);
-  //s->VALUE = buffer;
-  s->LEN_reg = buffer[0]; 
+
+  req = dma_req_new(s);
+  req->addr = s->SA_reg;
+  req->len = value;
+  dma_map(req, req->addr, req->len);
+  dma_submit(s, req);
+}
+
+static void dma_curdesc_write(popState *s, unsigned shift, uint32_t value)
+{
+    /* CURDESC is only writable while the channel is halted */
+    if (!(s->SR_reg & R_MM2S_DMASR_HALTED_MASK)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: CURDESC written while running\n",
+                      __func__);
+        return;
+    }
+    s->curdesc = deposit64(s->curdesc, shift, 32, value);
+    s->sg_next = s->curdesc;
+}
+
+static void dma_taildesc_write(popState *s, unsigned shift, uint32_t value)
+{
+    s->taildesc = deposit64(s->taildesc, shift, 32, value);
+    if (shift) {
+        /* Only a write to the LSB word rings the doorbell */
+        return;
+    }
+    if (s->SR_reg & R_MM2S_DMASR_HALTED_MASK) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: MM2S channel is halted\n",
+                      __func__);
+        return;
+    }
+    if (!s->dma_req) {
+        dma_sg_start(s, s->sg_next);
+    }
 }
 
 /* Initializes the write register */
 static void write_reg_init(popState *s){
     s->write_reg = 0;
-    s->bitcount = 0;
+    s->acc = s->kernel->init;
+    s->block_fill = 0;
 }
 
-/* Dummy function for reading the reset register - simply logs guest error*/
-static uint64_t r_read(void *opaque, hwaddr addr, unsigned int size){
-    qemu_log_mask(LOG_GUEST_ERROR, "READING RESET IS NOT USEFUL");
-    return 0;
+static uint64_t popcount_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    popState *s = opaque;
+    uint32_t ret = 0;
+
+    switch (addr) {
+    case A_POP_RESET:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: reset register is write-only\n",
+                      __func__);
+        break;
+    case A_POP_DATA:
+        ret = kernel_result(s->kernel, s->acc);
+        break;
+    case DMA_OFFSET + A_MM2S_DMACR:
+        ret = s->CR_reg;
+        break;
+    case DMA_OFFSET + A_MM2S_DMASR:
+        ret = s->SR_reg;
+        break;
+    case DMA_OFFSET + A_MM2S_CURDESC:
+        ret = extract64(s->curdesc, 0, 32);
+        break;
+    case DMA_OFFSET + A_MM2S_CURDESC_MSB:
+        ret = extract64(s->curdesc, 32, 32);
+        break;
+    case DMA_OFFSET + A_MM2S_TAILDESC:
+        ret = extract64(s->taildesc, 0, 32);
+        break;
+    case DMA_OFFSET + A_MM2S_TAILDESC_MSB:
+        ret = extract64(s->taildesc, 32, 32);
+        break;
+    case DMA_OFFSET + A_MM2S_SA:
+        ret = s->SA_reg;
+        break;
+    case DMA_OFFSET + A_MM2S_SA_MSB:
+        /* Simple mode only drives 32-bit source addresses */
+        break;
+    case DMA_OFFSET + A_MM2S_LENGTH:
+        ret = s->LEN_reg;
+        break;
+    case DMA_OFFSET + A_S2MM_DMACR:
+        ret = s->s2mm_cr;
+        break;
+    case DMA_OFFSET + A_S2MM_DMASR:
+        ret = s->s2mm_sr;
+        break;
+    case DMA_OFFSET + A_S2MM_CURDESC ... DMA_OFFSET + A_S2MM_TAILDESC_MSB:
+    case DMA_OFFSET + A_S2MM_DA_MSB:
+        break;
+    case DMA_OFFSET + A_S2MM_DA:
+        ret = s->s2mm_da;
+        break;
+    case DMA_OFFSET + A_S2MM_LENGTH:
+        ret = s->s2mm_len;
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+
+    trace_popcount_read(addr, ret);
+    return ret;
 }
 
-/* Reset Callback - resets the count and write register */
-static void r_write(void *opaque, hwaddr addr, uint64_t val64, unsigned int size){
+static void popcount_write(void *opaque, hwaddr addr, uint64_t val64,
+                           unsigned int size)
+{
     popState *s = opaque;
     uint32_t value = val64;
-    (void)s;
 
-    if (value != 0){
-        s->bitcount = 0;
-        s->write_reg = 0;
-    } 
+    trace_popcount_write(addr, value);
 
+    switch (addr) {
+    case A_POP_RESET:
+        /* Any non-zero write clears the count and the write register */
+        if (value != 0) {
+            write_reg_init(s);
+        }
+        break;
+    case A_POP_DATA:
+        pop_write(s, value);
+        break;
+    case DMA_OFFSET + A_MM2S_DMACR:
+        dma_cr_write(s, value);
+        break;
+    case DMA_OFFSET + A_MM2S_DMASR:
+        dma_sr_write(s, value);
+        break;
+    case DMA_OFFSET + A_MM2S_CURDESC:
+        dma_curdesc_write(s, 0, value);
+        break;
+    case DMA_OFFSET + A_MM2S_CURDESC_MSB:
+        dma_curdesc_write(s, 32, value);
+        break;
+    case DMA_OFFSET + A_MM2S_TAILDESC:
+        dma_taildesc_write(s, 0, value);
+        break;
+    case DMA_OFFSET + A_MM2S_TAILDESC_MSB:
+        dma_taildesc_write(s, 32, value);
+        break;
+    case DMA_OFFSET + A_MM2S_SA:
+        s->SA_reg = value;
+        break;
+    case DMA_OFFSET + A_MM2S_SA_MSB:
+        if (value) {
+            qemu_log_mask(LOG_UNIMP, "%s: 64-bit MM2S_SA not supported\n",
+                          __func__);
+        }
+        break;
+    case DMA_OFFSET + A_MM2S_LENGTH:
+        MM2S_LENGTH_write(s, value);
+        break;
+    case DMA_OFFSET + A_S2MM_DMACR:
+        s2mm_cr_write(s, value);
+        break;
+    case DMA_OFFSET + A_S2MM_DMASR:
+        s2mm_sr_write(s, value);
+        break;
+    case DMA_OFFSET + A_S2MM_CURDESC ... DMA_OFFSET + A_S2MM_TAILDESC_MSB:
+        qemu_log_mask(LOG_UNIMP, "%s: S2MM scatter-gather not supported\n",
+                      __func__);
+        break;
+    case DMA_OFFSET + A_S2MM_DA:
+        s->s2mm_da = value;
+        break;
+    case DMA_OFFSET + A_S2MM_DA_MSB:
+        if (value) {
+            qemu_log_mask(LOG_UNIMP, "%s: 64-bit S2MM_DA not supported\n",
+                          __func__);
+        }
+        break;
+    case DMA_OFFSET + A_S2MM_LENGTH:
+        s2mm_length_write(s, value);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
 }
 
-/* Memory operation binding for popcount region */
-static const MemoryRegionOps pop_ops = {
-    .read = pop_read,
-    .write = pop_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
+/*
+ * Every register is a 32-bit AXI-Lite word.  With .impl matching .valid
+ * the memory core dispatches each access straight to us, unsplit.
+ */
+static const MemoryRegionOps popcount_ops = {
+    .read = popcount_read,
+    .write = popcount_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
     .valid = {
-        .min_access_size = 1*sizeof(int),
-        .max_access_size = 2*sizeof(int)}
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+    .impl = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
 };
 
-/* Memory operation binding for reset region */
-static const MemoryRegionOps r_ops = {
-    .read = r_read,
-    .write = r_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-    .valid = {
-        .min_access_size = 1,
-        .max_access_size = 4}
-};
+DeviceState *popcount_create(hwaddr addr, qemu_irq irq)
+{
+    DeviceState *dev;
+    SysBusDevice *s;
 
-static const MemoryRegionOps dma_cr_ops = {
-  .read = dma_cr_read,
-  .write = dma_cr_write,
-  .endianness = DEVICE_NATIVE_ENDIAN,
-  .valid = {
-    .min_access_size = 1,
-    .max_access_size = 64}
-};
-static const MemoryRegionOps dma_sr_ops = {
-  .read = dma_sr_read,
-  .write = dma_sr_write,
-  .endianness = DEVICE_NATIVE_ENDIAN,
-  .valid = {
-    .min_access_size = 1,
-    .max_access_size = 64}
-};
-static const MemoryRegionOps dma_sa_ops = {
-  .read = dma_sa_read,
-  .write = dma_sa_write,
-  .endianness = DEVICE_NATIVE_ENDIAN,
-  .valid = {
-    .min_access_size = 1,
-    .max_access_size = 64}
+    dev = qdev_new(TYPE_POPCOUNT);
+    s = SYS_BUS_DEVICE(dev);
+    sysbus_realize_and_unref(s, &error_fatal);
+    sysbus_mmio_map(s, 0, addr);
+    sysbus_connect_irq(s, 0, irq);
+
+    return dev;
+}
+
+static int popcount_pre_save(void *opaque)
+{
+    popState *s = opaque;
+    PopcountDMAReq *req = s->dma_req;
+
+    /*
+     * A running transfer has not touched any device state yet, so it is
+     * enough to record where it started and run it again on the other side.
+     * Without one, dma_inflight still describes a transfer that was loaded
+     * but not restarted yet, if any.
+     */
+    if (req) {
+        s->dma_inflight = req->sg ? DMA_INFLIGHT_SG : DMA_INFLIGHT_SIMPLE;
+        s->dma_addr = req->addr;
+        s->dma_len = req->len;
+        s->dma_deadline = req->deadline;
+    }
+    return 0;
+}
+
+static int popcount_post_load(void *opaque, int version_id)
+{
+    popState *s = opaque;
+
+    /*
+     * Guest RAM may not all be here yet (postcopy), so the transfer is only
+     * restarted once the VM runs; see popcount_vm_state_change().
+     */
+    s->dma_req = NULL;
+    return s->dma_inflight <= DMA_INFLIGHT_SG ? 0 : -EINVAL;
+}
+
+static void popcount_dma_restart_bh(void *opaque)
+{
+    popState *s = opaque;
+    PopcountDMAReq *req;
+
+    if (s->dma_req || s->dma_inflight == DMA_INFLIGHT_NONE) {
+        return;
+    }
+
+    req = dma_req_new(s);
+    req->addr = s->dma_addr;
+    req->deadline = s->dma_deadline;
+    if (s->dma_inflight == DMA_INFLIGHT_SG) {
+        req->sg = true;
+        dma_sg_map(s, req, req->addr);
+    } else {
+        req->len = s->dma_len;
+        dma_map(req, req->addr, req->len);
+    }
+    s->dma_inflight = DMA_INFLIGHT_NONE;
+    dma_submit(s, req);
+}
+
+static void popcount_vm_state_change(void *opaque, bool running,
+                                     RunState state)
+{
+    popState *s = opaque;
+
+    if (running && s->dma_inflight != DMA_INFLIGHT_NONE) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                popcount_dma_restart_bh, s);
+    }
+}
+
+static const VMStateDescription vmstate_popcount = {
+    .name = TYPE_POPCOUNT,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = popcount_pre_save,
+    .post_load = popcount_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(write_reg, popState),
+        VMSTATE_UINT32(acc, popState),
+        VMSTATE_UINT64(CR_reg, popState),
+        VMSTATE_UINT64(SR_reg, popState),
+        VMSTATE_UINT32(SA_reg, popState),
+        VMSTATE_UINT32(LEN_reg, popState),
+        VMSTATE_UINT64(curdesc, popState),
+        VMSTATE_UINT64(taildesc, popState),
+        VMSTATE_UINT64(sg_next, popState),
+        VMSTATE_UINT8(irq_count, popState),
+        VMSTATE_UINT8(dma_inflight, popState),
+        VMSTATE_UINT64(dma_addr, popState),
+        VMSTATE_UINT32(dma_len, popState),
+        VMSTATE_INT64(dma_deadline, popState),
+        VMSTATE_UINT32(block_fill, popState),
+        VMSTATE_UINT32(s2mm_cr, popState),
+        VMSTATE_UINT32(s2mm_sr, popState),
+        VMSTATE_UINT32(s2mm_da, popState),
+        VMSTATE_UINT32(s2mm_len, popState),
+        VMSTATE_UINT32(s2mm_done, popState),
+        VMSTATE_BOOL(s2mm_busy, popState),
+        VMSTATE_END_OF_LIST()
+    }
 };
-static const MemoryRegionOps dma_len_ops = {
-  .read = dma_len_read,
-  .write = MM2S_LENGTH_write,
-  .endianness = DEVICE_NATIVE_ENDIAN,
-  .valid = {
-    .min_access_size = 1,
-    .max_access_size = 64}
+
+static Property popcount_properties[] = {
+    /* Reduction the core applies to the stream; "popcount" if unset */
+    DEFINE_PROP_STRING("kernel", popState, kernel_name),
+    /* Emit one result per this many stream bytes instead of per packet */
+    DEFINE_PROP_UINT32("block-size", popState, block_size, 0),
+    /* Modelled accelerator time per 32-bit stream word, and per transfer */
+    DEFINE_PROP_UINT64("word-latency-ns", popState, word_latency_ns, 0),
+    DEFINE_PROP_UINT64("transfer-latency-ns", popState, transfer_latency_ns,
+                       0),
+    DEFINE_PROP_END_OF_LIST(),
 };
 
-/* Initialization of the popcount hardware DEVICE_NATIVE_ENDIAN
- * May be desirable to make this of type void in the future to match 
- * QEMU hw device protocol more typically
- */
-popState *popcount_create(MemoryRegion *address_space, hwaddr base)
+static void popcount_init(Object *obj)
+{
+    SysBusDevice *sbd = SYS_BUS_DEVICE(obj);
+    popState *s = POPCOUNT(obj);
+
+    memory_region_init_io(&s->iomem, obj, &popcount_ops, s, TYPE_POPCOUNT,
+                          POPCOUNT_MMIO_SIZE);
+    sysbus_init_mmio(sbd, &s->iomem);
+    sysbus_init_irq(sbd, &s->irq);
+}
+
+static void popcount_realize(DeviceState *dev, Error **errp)
 {
-    popState *s = g_malloc0(sizeof(popState));
+    popState *s = POPCOUNT(dev);
+
+    s->kernel = popcount_find_kernel(s->kernel_name ?: "popcount");
+    if (!s->kernel) {
+        error_setg(errp, "unknown kernel '%s'", s->kernel_name);
+        return;
+    }
+    if (s->block_size % 4) {
+        error_setg(errp, "block-size must be a multiple of 4");
+        return;
+    }
+    s->dma_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, dma_timer_cb, s);
+    qdev_add_vm_change_state_handler(dev, popcount_vm_state_change, s);
+}
+
+static void popcount_reset(DeviceState *dev)
+{
+    popState *s = POPCOUNT(dev);
+
     write_reg_init(s);
-    memory_region_init_io(&s->reset, NULL, &r_ops, s, TYPE_POPCOUNT, 4);
-    memory_region_init_io(&s->mmio, NULL, &pop_ops, s, TYPE_POPCOUNT, 32);
-    memory_region_init_io(&s->MM2S_DMACR, NULL, &dma_cr_ops, s, TYPE_POPCOUNT, 32);
-    memory_region_init_io(&s->MM2S_DMASR, NULL, &dma_sr_ops, s, TYPE_POPCOUNT, 32);
-    memory_region_init_io(&s->MM2S_SA, NULL, &dma_sa_ops, s, TYPE_POPCOUNT, 32);
-    memory_region_init_io(&s->MM2S_LENGTH, NULL, &dma_len_ops, s, TYPE_POPCOUNT, 32);
-    memory_region_add_subregion(address_space, base, &s->reset);
-    memory_region_add_subregion(address_space, base+4, &s->mmio);
-    memory_region_add_subregion(address_space, base+DMA_OFFSET, &s->MM2S_DMACR);
-    memory_region_add_subregion(address_space, base+DMA_OFFSET+4, &s->MM2S_DMASR);
-    memory_region_add_subregion(address_space, base+DMA_OFFSET+0x18, &s->MM2S_SA);
-    memory_region_add_subregion(address_space, base+DMA_OFFSET+0x28, &s->MM2S_LENGTH);
-    s->base = base;
-    return s;
+    dma_reset(s);
+}
+
+static void popcount_class_init(ObjectClass *oc, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(oc);
+
+    dc->realize = popcount_realize;
+    dc->reset = popcount_reset;
+    dc->vmsd = &vmstate_popcount;
+    device_class_set_props(dc, popcount_properties);
+    /* Extra instances go on the platform bus of machines that allow it */
+    dc->user_creatable = true;
+}
+
+static const TypeInfo popcount_info = {
+    .name          = TYPE_POPCOUNT,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(popState),
+    .instance_init = popcount_init,
+    .class_init    = popcount_class_init,
+};
+
+static void popcount_register_types(void)
+{
+    type_register_static(&popcount_info);
 }
 
+type_init(popcount_register_types)
@@ -0,0 +1 @@
+#include "trace/trace-hw_popcount.h"
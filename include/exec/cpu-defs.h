@@ -226,6 +226,9 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t large_flush_count;
+    size_t victim_hit_count;
+    size_t fill_count;
 } CPUTLBCommon;
 
 /*
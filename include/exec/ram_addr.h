@@ -425,6 +425,25 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
         }
     }
 }
+
+/*
+ * Mark the host page at @start dirty for the same clients as
+ * cpu_physical_memory_set_dirty_lebitmap() would, for callers that learn
+ * about dirty pages one at a time.  Such callers may see a page more than
+ * once between two syncs, so accounting it in total_dirty_pages is left
+ * to them.
+ */
+static inline void cpu_physical_memory_set_dirty_host_page(ram_addr_t start)
+{
+    uint8_t clients = tcg_enabled() ? DIRTY_CLIENTS_ALL : DIRTY_CLIENTS_NOCODE;
+
+    if (!global_dirty_tracking) {
+        clients &= ~(1 << DIRTY_MEMORY_MIGRATION);
+    }
+
+    cpu_physical_memory_set_dirty_range(start, qemu_real_host_page_size(),
+                                        clients);
+}
 #endif /* not _WIN32 */
 
 bool cpu_physical_memory_test_and_clear_dirty(ram_addr_t start,
@@ -447,6 +466,66 @@ static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
 }
 
 
+/*
+ * Move the DIRTY_MEMORY_MIGRATION bits of [@start, @start + @length) into
+ * rb->bmap, returning the number of pages that were not dirty there yet.
+ * The range must be aligned to a word of the dirty bitmap, see
+ * cpu_physical_memory_sync_dirty_aligned().  Only the words of rb->bmap
+ * that cover the range are written, so disjoint ranges may be synced
+ * concurrently.  The caller is responsible for the clear_bmap.
+ *
+ * Called with RCU critical section
+ */
+static inline
+uint64_t cpu_physical_memory_sync_dirty_words(RAMBlock *rb,
+                                              ram_addr_t start,
+                                              ram_addr_t length)
+{
+    unsigned long word = BIT_WORD((start + rb->offset) >> TARGET_PAGE_BITS);
+    uint64_t num_dirty = 0;
+    unsigned long *dest = rb->bmap;
+    int k;
+    int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
+    unsigned long * const *src;
+    unsigned long idx = (word * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
+    unsigned long offset = BIT_WORD((word * BITS_PER_LONG) %
+                                    DIRTY_MEMORY_BLOCK_SIZE);
+    unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
+
+    src = qatomic_rcu_read(
+            &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
+
+    for (k = page; k < page + nr; k++) {
+        if (src[idx][offset]) {
+            unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
+            unsigned long new_dirty;
+            new_dirty = ~dest[k];
+            dest[k] |= bits;
+            new_dirty &= bits;
+            num_dirty += ctpopl(new_dirty);
+        }
+
+        if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+            offset = 0;
+            idx++;
+        }
+    }
+
+    return num_dirty;
+}
+
+/* start address and length is aligned at the start of a word? */
+static inline bool cpu_physical_memory_sync_dirty_aligned(RAMBlock *rb,
+                                                          ram_addr_t start,
+                                                          ram_addr_t length)
+{
+    unsigned long word = BIT_WORD((start + rb->offset) >> TARGET_PAGE_BITS);
+
+    return ((word * BITS_PER_LONG) << TARGET_PAGE_BITS) ==
+           (start + rb->offset) &&
+           !(length & ((BITS_PER_LONG << TARGET_PAGE_BITS) - 1));
+}
+
 /* Called with RCU critical section */
 static inline
 uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
@@ -454,40 +533,11 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                                                ram_addr_t length)
 {
     ram_addr_t addr;
-    unsigned long word = BIT_WORD((start + rb->offset) >> TARGET_PAGE_BITS);
     uint64_t num_dirty = 0;
     unsigned long *dest = rb->bmap;
 
-    /* start address and length is aligned at the start of a word? */
-    if (((word * BITS_PER_LONG) << TARGET_PAGE_BITS) ==
-         (start + rb->offset) &&
-        !(length & ((BITS_PER_LONG << TARGET_PAGE_BITS) - 1))) {
-        int k;
-        int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
-        unsigned long * const *src;
-        unsigned long idx = (word * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
-        unsigned long offset = BIT_WORD((word * BITS_PER_LONG) %
-                                        DIRTY_MEMORY_BLOCK_SIZE);
-        unsigned long page = BIT_WORD(start >> TARGET_PAGE_BITS);
-
-        src = qatomic_rcu_read(
-                &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
-
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
-                unsigned long new_dirty;
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
-                new_dirty &= bits;
-                num_dirty += ctpopl(new_dirty);
-            }
-
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
-                offset = 0;
-                idx++;
-            }
-        }
+    if (cpu_physical_memory_sync_dirty_aligned(rb, start, length)) {
+        num_dirty = cpu_physical_memory_sync_dirty_words(rb, start, length);
 
         if (rb->clear_bmap) {
             /*
@@ -75,6 +75,15 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * With the mapped-ram capability, where this block's bitmap and pages
+     * are in the migration file.  On the source, file_bmap tracks which
+     * pages the file holds; it is protected by ram_state.bitmap_mutex.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    off_t pages_offset;
 };
 #endif
 #endif
@@ -9,9 +9,79 @@
 #define HW_PDMA_H
 
 #include "hw/sysbus.h"
+#include "hw/registerfields.h"
 #include "qom/object.h"
 
-#define TYPE_PDMA "PDMA"
+#define TYPE_PDMA "popcount-dma"
+
+/* AXI DMA (Xilinx PG021) MM2S channel registers */
+REG32(MM2S_DMACR, 0x00)
+    FIELD(MM2S_DMACR, RS, 0, 1)
+    FIELD(MM2S_DMACR, RESET, 2, 1)
+    FIELD(MM2S_DMACR, IOC_IRQ_EN, 12, 1)
+    FIELD(MM2S_DMACR, DLY_IRQ_EN, 13, 1)
+    FIELD(MM2S_DMACR, ERR_IRQ_EN, 14, 1)
+    FIELD(MM2S_DMACR, IRQ_THRESHOLD, 16, 8)
+    FIELD(MM2S_DMACR, IRQ_DELAY, 24, 8)
+REG32(MM2S_DMASR, 0x04)
+    FIELD(MM2S_DMASR, HALTED, 0, 1)
+    FIELD(MM2S_DMASR, IDLE, 1, 1)
+    FIELD(MM2S_DMASR, SG_INCLD, 3, 1)
+    FIELD(MM2S_DMASR, DMA_INT_ERR, 4, 1)
+    FIELD(MM2S_DMASR, DMA_SLV_ERR, 5, 1)
+    FIELD(MM2S_DMASR, DMA_DEC_ERR, 6, 1)
+    FIELD(MM2S_DMASR, SG_INT_ERR, 8, 1)
+    FIELD(MM2S_DMASR, SG_SLV_ERR, 9, 1)
+    FIELD(MM2S_DMASR, SG_DEC_ERR, 10, 1)
+    FIELD(MM2S_DMASR, IOC_IRQ, 12, 1)
+    FIELD(MM2S_DMASR, DLY_IRQ, 13, 1)
+    FIELD(MM2S_DMASR, ERR_IRQ, 14, 1)
+    FIELD(MM2S_DMASR, IRQ_THRESHOLD_STS, 16, 8)
+    FIELD(MM2S_DMASR, IRQ_DELAY_STS, 24, 8)
+REG32(MM2S_CURDESC, 0x08)
+REG32(MM2S_CURDESC_MSB, 0x0C)
+REG32(MM2S_TAILDESC, 0x10)
+REG32(MM2S_TAILDESC_MSB, 0x14)
+REG32(MM2S_SA, 0x18)
+REG32(MM2S_SA_MSB, 0x1C)
+REG32(MM2S_LENGTH, 0x28)
+    FIELD(MM2S_LENGTH, LENGTH, 0, 26)   /* bits 31-26 are reserved */
+
+/* S2MM channel registers; DMACR and DMASR have the MM2S layout */
+REG32(S2MM_DMACR, 0x30)
+REG32(S2MM_DMASR, 0x34)
+REG32(S2MM_CURDESC, 0x38)
+REG32(S2MM_CURDESC_MSB, 0x3C)
+REG32(S2MM_TAILDESC, 0x40)
+REG32(S2MM_TAILDESC_MSB, 0x44)
+REG32(S2MM_DA, 0x48)
+REG32(S2MM_DA_MSB, 0x4C)
+REG32(S2MM_LENGTH, 0x58)
+    FIELD(S2MM_LENGTH, LENGTH, 0, 26)
+
+#define DMACR_RESET_VALUE   0x00010000
+#define DMASR_RESET_VALUE   R_MM2S_DMASR_HALTED_MASK
+#define DMASR_IRQ_MASK      (R_MM2S_DMASR_IOC_IRQ_MASK | \
+                             R_MM2S_DMASR_DLY_IRQ_MASK | \
+                             R_MM2S_DMASR_ERR_IRQ_MASK)
+
+/* Scatter-gather descriptor layout; the APP words that follow are unused */
+#define SG_DESC_NXTDESC         0x00
+#define SG_DESC_BUFFER_ADDRESS  0x08
+#define SG_DESC_CONTROL         0x18
+#define SG_DESC_STATUS          0x1C
+#define SG_DESC_SIZE            0x20
+
+#define SG_CTRL_LENGTH_MASK     0x3FFFFFF
+#define SG_CTRL_TXEOF           (1u << 26)
+#define SG_CTRL_TXSOF           (1u << 27)
+#define SG_STS_DMA_INT_ERR      (1u << 28)
+#define SG_STS_DMA_SLV_ERR      (1u << 29)
+#define SG_STS_DMA_DEC_ERR      (1u << 30)
+#define SG_STS_CMPLT            (1u << 31)
+
+/* MM2S_LENGTH bits 31-26 are reserved */
+#define DMA_LENGTH_MASK     0x3FFFFFF
 
 typedef struct pdmaState pdmaState;
 
@@ -20,18 +90,17 @@ DECLARE_INSTANCE_CHECKER(pdmaState, PDMA, TYPE_PDMA)
 struct pdmaState
 {
     SysBusDevice parent_obj;
-    MemoryRegion MM2S_DMACR;
-    MemoryRegion MM2S_DMASR;
-    MemoryRegion MM2S_SA;
-    MemoryRegion MM2S_LENGTH;
+    MemoryRegion iomem;
+
+    qemu_irq irq;
 
     uint64_t CR_reg;
+    uint32_t SR_reg;
     uint32_t SA_reg; // This is uncecessary, its unaccessable in userspace
     uint32_t LEN_reg;
-    uint32_t VALUE;
-    uint8_t start;
+    uint64_t dest;         /* stream sink, normally a popcount data port */
 };
 
-pdmaState *pdma_create(MemoryRegion *address_space, hwaddr base);
+DeviceState *pdma_create(hwaddr addr, hwaddr dest, qemu_irq irq);
 
 #endif //HW_PDMA_H
@@ -12,29 +12,60 @@
 #include "hw/sysbus.h"
 #include "qom/object.h"
 
-#define TYPE_POPCOUNT "POPCOUNT"
+#define TYPE_POPCOUNT "popcount"
 
 typedef struct popState popState;
+typedef struct PopcountDMAReq PopcountDMAReq;
+typedef struct PopcountKernel PopcountKernel;
 
 DECLARE_INSTANCE_CHECKER(popState, POPCOUNT, TYPE_POPCOUNT)
 
+enum {
+    DMA_INFLIGHT_NONE,
+    DMA_INFLIGHT_SIMPLE,
+    DMA_INFLIGHT_SG,
+};
+
 struct popState
 {
-    MemoryRegion reset;
-    MemoryRegion mmio;
-    MemoryRegion MM2S_DMACR;
-    MemoryRegion MM2S_DMASR;
-    MemoryRegion MM2S_SA;
-    MemoryRegion MM2S_LENGTH;
+    SysBusDevice parent_obj;
+
+    MemoryRegion iomem;
+    qemu_irq irq;
+    PopcountDMAReq *dma_req; /* MM2S transfer running on a worker thread */
+    QEMUTimer *dma_timer;    /* fires when the modelled transfer time ends */
+    uint64_t word_latency_ns;
+    uint64_t transfer_latency_ns;
+    char *kernel_name;
+    const PopcountKernel *kernel;
+    uint32_t block_size;     /* stream bytes per S2MM result, 0 per packet */
     uint32_t write_reg; // This is uncecessary, its unaccessable in userspace
-    uint32_t bitcount;
+    uint32_t acc;            /* running reduction, read back via POP_DATA */
     uint64_t CR_reg;
     uint64_t SR_reg;
     uint32_t SA_reg;  
     uint32_t LEN_reg;
-    uint32_t base;
+    uint64_t curdesc;
+    uint64_t taildesc;
+    uint64_t sg_next;      /* next descriptor to fetch */
+    uint8_t irq_count;     /* packets left before IOC, IRQThresholdSts */
+    uint32_t block_fill;   /* stream bytes into the current result block */
+
+    /* S2MM channel, simple mode only */
+    uint32_t s2mm_cr;
+    uint32_t s2mm_sr;
+    uint32_t s2mm_da;
+    uint32_t s2mm_len;
+    uint32_t s2mm_done;    /* bytes written to the current buffer */
+    bool s2mm_busy;        /* a buffer is armed and waiting for results */
+
+    /* Running transfer, as recorded for migration and until restarted */
+    uint8_t dma_inflight;
+    uint64_t dma_addr;
+    uint32_t dma_len;
+    int64_t dma_deadline;
 };
 
-popState *popcount_create(MemoryRegion *address_space, hwaddr base);
+DeviceState *popcount_create(hwaddr addr, qemu_irq irq);
 
 #endif //HW_POPCOUNT_H
@@ -65,6 +65,9 @@
 #ifndef bit_AVX512VBMI2
 #define bit_AVX512VBMI2 (1 << 6)
 #endif
+#ifndef bit_AVX512VPOPCNTDQ
+#define bit_AVX512VPOPCNTDQ (1 << 14)
+#endif
 
 /* Leaf 0x80000001, %ecx */
 #ifndef bit_LZCNT
@@ -190,6 +190,8 @@ char *freq_to_str(uint64_t freq_hz);
 
 bool buffer_is_zero(const void *buf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
+uint64_t buffer_popcount(const void *buf, size_t len);
+bool test_buffer_popcount_next_accel(void);
 
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
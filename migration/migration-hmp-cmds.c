@@ -49,6 +49,10 @@ static void migration_global_dump(Monitor *mon)
                    ms->decompress_error_check ? "on" : "off");
     monitor_printf(mon, "clear-bitmap-shift: %u\n",
                    ms->clear_bitmap_shift);
+    monitor_printf(mon, "bitmap-sync-threads: %u\n",
+                   ms->bitmap_sync_threads);
+    monitor_printf(mon, "postcopy-prefetch-pages: %u\n",
+                   ms->postcopy_prefetch_pages);
 }
 
 void hmp_info_migrate(Monitor *mon, const QDict *qdict)
@@ -206,6 +210,23 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
         g_free(str);
         visit_free(v);
     }
+
+    if (info->has_postcopy_latency) {
+        monitor_printf(mon, "postcopy latency: %" PRIu64 " us\n",
+                       info->postcopy_latency);
+    }
+
+    if (info->has_postcopy_latency_dist) {
+        Visitor *v;
+        char *str;
+        v = string_output_visitor_new(false, &str);
+        visit_type_uint64List(v, NULL, &info->postcopy_latency_dist,
+                              &error_abort);
+        visit_complete(v, &str);
+        monitor_printf(mon, "postcopy latency distribution: %s\n", str);
+        g_free(str);
+        visit_free(v);
+    }
     if (info->has_socket_address) {
         SocketAddressList *addr;
 
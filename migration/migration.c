@@ -20,6 +20,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
@@ -117,10 +118,16 @@ migration_channels_and_uri_compatible(const char *uri, Error **errp)
         return false;
     }
 
+    if (migrate_mapped_ram() && !strstart(uri, "file:", NULL)) {
+        error_setg(errp, "Mapped-ram requires a file: URI");
+        return false;
+    }
+
     return true;
 }
 
-static gint page_request_addr_cmp(gconstpointer ap, gconstpointer bp)
+static gint page_request_addr_cmp(gconstpointer ap, gconstpointer bp,
+                                  gpointer opaque)
 {
     uintptr_t a = (uintptr_t) ap, b = (uintptr_t) bp;
 
@@ -151,7 +158,8 @@ void migration_object_init(void)
     qemu_sem_init(&current_incoming->postcopy_qemufile_dst_done, 0);
 
     qemu_mutex_init(&current_incoming->page_request_mutex);
-    current_incoming->page_requested = g_tree_new(page_request_addr_cmp);
+    current_incoming->page_requested = g_tree_new_full(page_request_addr_cmp,
+                                                       NULL, NULL, g_free);
 
     migration_object_check(current_migration, &error_fatal);
 
@@ -311,11 +319,11 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      ram_addr_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -358,10 +366,13 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         if (!received && !g_tree_lookup(mis->page_requested, aligned)) {
             /*
              * The page has not been received, and it's not yet in the page
-             * request list.  Queue it.  Set the value of element to 1, so that
-             * things like g_tree_lookup() will return TRUE (1) when found.
+             * request list.  Queue it, noting the time for the latency
+             * statistics.
              */
-            g_tree_insert(mis->page_requested, aligned, (gpointer)1);
+            PostcopyPageRequest *req = g_new(PostcopyPageRequest, 1);
+
+            req->time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+            g_tree_insert(mis->page_requested, aligned, req);
             mis->page_requested_count++;
             trace_postcopy_page_req_add(aligned, mis->page_requested_count);
         }
@@ -375,7 +386,8 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
 }
 
 static bool migration_colo_enabled;
@@ -442,6 +454,8 @@ static void qemu_start_incoming_migration(const char *uri, Error **errp)
         exec_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -1662,6 +1676,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         exec_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         if (!(has_resume && resume)) {
             yank_unregister_instance(MIGRATION_YANK_INSTANCE);
@@ -71,6 +71,12 @@ typedef enum {
     PREEMPT_THREAD_QUIT,
 } PreemptThreadStatus;
 
+/* A page that the postcopy fault thread requested from the source VM */
+typedef struct PostcopyPageRequest {
+    /* When the request was sent, QEMU_CLOCK_REALTIME in microseconds */
+    int64_t time;
+} PostcopyPageRequest;
+
 /* State for the incoming migration */
 struct MigrationIncomingState {
     QEMUFile *from_src_file;
@@ -193,7 +199,10 @@ struct MigrationIncomingState {
     /* List of listening socket addresses  */
     SocketAddressList *socket_address_list;
 
-    /* A tree of pages that we requested to the source VM */
+    /*
+     * A tree of pages that we requested to the source VM, keyed by host
+     * address, with a PostcopyPageRequest for each.
+     */
     GTree *page_requested;
     /* For debugging purpose only, but would be nice to keep */
     int page_requested_count;
@@ -420,6 +429,14 @@ struct MigrationState {
      * Default value is false. (since 8.1)
      */
     bool multifd_flush_after_each_section;
+    /*
+     * Detect zero pages in the multifd channel threads and send them as
+     * a list of offsets in the packet header, instead of checking every
+     * page on the migration thread and sending RAM_SAVE_FLAG_ZERO.
+     * Destinations older than 8.1 ignore the list, so this is off for
+     * older machine types.  Default value is true. (since 8.1)
+     */
+    bool multifd_zero_page;
     /*
      * This decides the size of guest memory chunk that will be used
      * to track dirty bitmap clearing.  The size of memory chunk will
@@ -429,6 +446,19 @@ struct MigrationState {
      * (which is in 4M chunk).
      */
     uint8_t clear_bitmap_shift;
+    /*
+     * Number of threads that merge the dirty log into the RAMBlock
+     * dirty bitmaps during a bitmap sync, including the migration
+     * thread itself.  1 keeps the sync serial.
+     */
+    uint8_t bitmap_sync_threads;
+    /*
+     * Number of pages that the postcopy fault thread asks for on top of
+     * each faulting page: the ones that follow it, and the same number
+     * along a stride if successive faults are evenly spaced.  0 disables
+     * prefetching; values above MAX_POSTCOPY_PREFETCH_PAGES are capped.
+     */
+    uint32_t postcopy_prefetch_pages;
 
     /*
      * This save hostname when out-going migration starts
@@ -473,7 +503,8 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      ram_addr_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -34,6 +34,9 @@
 
 #define MAX_THROTTLE  (128 << 20)      /* Migration transfer speed throttling */
 
+/* Pages asked for on top of each postcopy fault */
+#define MAX_POSTCOPY_PREFETCH_PAGES 16
+
 /* Time in milliseconds we are allowed to stop the source,
  * for sending the last part */
 #define DEFAULT_MIGRATE_SET_DOWNTIME 300
@@ -91,8 +94,14 @@ Property migration_properties[] = {
                       decompress_error_check, true),
     DEFINE_PROP_BOOL("multifd-flush-after-each-section", MigrationState,
                       multifd_flush_after_each_section, false),
+    DEFINE_PROP_BOOL("multifd-zero-page", MigrationState,
+                      multifd_zero_page, true),
     DEFINE_PROP_UINT8("x-clear-bitmap-shift", MigrationState,
                       clear_bitmap_shift, CLEAR_BITMAP_SHIFT_DEFAULT),
+    DEFINE_PROP_UINT8("x-bitmap-sync-threads", MigrationState,
+                      bitmap_sync_threads, 1),
+    DEFINE_PROP_UINT32("x-postcopy-prefetch-pages", MigrationState,
+                      postcopy_prefetch_pages, 0),
     DEFINE_PROP_BOOL("x-preempt-pre-7-2", MigrationState,
                      preempt_pre_7_2, false),
 
@@ -185,6 +194,7 @@ Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-zero-copy-send",
             MIGRATION_CAPABILITY_ZERO_COPY_SEND),
 #endif
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -252,6 +262,13 @@ bool migrate_late_block_activate(void)
     return s->capabilities[MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE];
 }
 
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
 bool migrate_multifd(void)
 {
     MigrationState *s = migrate_get_current();
@@ -345,6 +362,27 @@ bool migrate_multifd_flush_after_each_section(void)
     return s->multifd_flush_after_each_section;
 }
 
+bool migrate_multifd_zero_page(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->multifd_zero_page;
+}
+
+uint8_t migrate_bitmap_sync_threads(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return MAX(s->bitmap_sync_threads, 1);
+}
+
+uint32_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return MIN(s->postcopy_prefetch_pages, MAX_POSTCOPY_PREFETCH_PAGES);
+}
+
 bool migrate_postcopy(void)
 {
     return migrate_postcopy_ram() || migrate_dirty_bitmaps();
@@ -415,6 +453,21 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
     MIGRATION_CAPABILITY_ZERO_COPY_SEND);
 
+/*
+ * Mapped-ram compatibility check list: pages are written in place in the
+ * file, so nothing that changes how a page is encoded in the stream or
+ * sends it elsewhere.
+ */
+static const
+INITIALIZE_MIGRATE_CAPS_SET(check_caps_mapped_ram,
+    MIGRATION_CAPABILITY_XBZRLE,
+    MIGRATION_CAPABILITY_COMPRESS,
+    MIGRATION_CAPABILITY_MULTIFD,
+    MIGRATION_CAPABILITY_POSTCOPY_RAM,
+    MIGRATION_CAPABILITY_X_COLO,
+    MIGRATION_CAPABILITY_RELEASE_RAM,
+    MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT);
+
 /**
  * @migration_caps_check - check capability compatibility
  *
@@ -547,6 +600,20 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        int idx;
+
+        for (idx = 0; idx < check_caps_mapped_ram.size; idx++) {
+            int incomp_cap = check_caps_mapped_ram.caps[idx];
+            if (new_caps[incomp_cap]) {
+                error_setg(errp,
+                        "Mapped-ram is not compatible with %s",
+                        MigrationCapability_str(incomp_cap));
+                return false;
+            }
+        }
+    }
+
     return true;
 }
 
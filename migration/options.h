@@ -32,6 +32,7 @@ bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
 bool migrate_ignore_shared(void);
 bool migrate_late_block_activate(void);
+bool migrate_mapped_ram(void);
 bool migrate_multifd(void);
 bool migrate_pause_before_switchover(void);
 bool migrate_postcopy_blocktime(void);
@@ -53,6 +54,9 @@ bool migrate_zero_copy_send(void);
  */
 
 bool migrate_multifd_flush_after_each_section(void);
+bool migrate_multifd_zero_page(void);
+uint8_t migrate_bitmap_sync_threads(void);
+uint32_t migrate_postcopy_prefetch_pages(void);
 bool migrate_postcopy(void);
 bool migrate_tls(void);
 
@@ -18,6 +18,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/madvise.h"
+#include "qemu/host-utils.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
@@ -113,6 +114,12 @@ void postcopy_thread_create(MigrationIncomingState *mis,
 #include <sys/eventfd.h>
 #include <linux/userfaultfd.h>
 
+/*
+ * Bucket n of the page request latency histogram counts requests that
+ * took [2^n, 2^(n+1)) microseconds, see @postcopy-latency-dist.
+ */
+#define POSTCOPY_LATENCY_BUCKETS 32
+
 typedef struct PostcopyBlocktimeContext {
     /* time when page fault initiated per vCPU */
     uint32_t *page_fault_vcpu_time;
@@ -127,6 +134,11 @@ typedef struct PostcopyBlocktimeContext {
     int smp_cpus_down;
     uint64_t start_time;
 
+    /* page request latencies, updated with page_request_mutex held */
+    uint64_t latency_total;
+    uint64_t latency_count;
+    uint64_t latency_dist[POSTCOPY_LATENCY_BUCKETS];
+
     /*
      * Handler for exit event, necessary for
      * releasing whole blocktime_ctx
@@ -177,6 +189,18 @@ static uint32List *get_vcpu_blocktime_list(PostcopyBlocktimeContext *ctx)
     return list;
 }
 
+static uint64List *get_latency_dist_list(PostcopyBlocktimeContext *ctx)
+{
+    uint64List *list = NULL;
+    int i;
+
+    for (i = POSTCOPY_LATENCY_BUCKETS - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(list, ctx->latency_dist[i]);
+    }
+
+    return list;
+}
+
 /*
  * This function just populates MigrationInfo from postcopy's
  * blocktime context. It will not populate MigrationInfo,
@@ -197,6 +221,11 @@ void fill_destination_postcopy_migration_info(MigrationInfo *info)
     info->postcopy_blocktime = bc->total_blocktime;
     info->has_postcopy_vcpu_blocktime = true;
     info->postcopy_vcpu_blocktime = get_vcpu_blocktime_list(bc);
+    info->has_postcopy_latency = true;
+    info->postcopy_latency = bc->latency_count ?
+                             bc->latency_total / bc->latency_count : 0;
+    info->has_postcopy_latency_dist = true;
+    info->postcopy_latency_dist = get_latency_dist_list(bc);
 }
 
 static uint32_t get_postcopy_total_blocktime(void)
@@ -937,12 +966,146 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
     trace_postcopy_pause_fault_thread_continued();
 }
 
+/*
+ * Account the time it took to serve a page request in the latency
+ * histogram.  Called with page_request_mutex held.
+ */
+static void mark_postcopy_latency(MigrationIncomingState *mis,
+                                  PostcopyPageRequest *req)
+{
+    PostcopyBlocktimeContext *dc = mis->blocktime_ctx;
+    uint64_t latency;
+    int bucket;
+
+    if (!dc) {
+        return;
+    }
+
+    latency = MAX(qemu_clock_get_us(QEMU_CLOCK_REALTIME) - req->time, 0);
+    bucket = latency ? MIN(63 - clz64(latency),
+                           POSTCOPY_LATENCY_BUCKETS - 1) : 0;
+
+    dc->latency_total += latency;
+    dc->latency_count++;
+    dc->latency_dist[bucket]++;
+}
+
+/* What the fault thread remembers of the previous faults for prefetching */
+typedef struct PostcopyPrefetchState {
+    RAMBlock *rb;
+    ram_addr_t last_fault;
+    int64_t stride;
+    /* End of the pages that followed the previous fault and were asked for */
+    ram_addr_t next;
+} PostcopyPrefetchState;
+
+/* Whether the page at @start of @rb is neither there nor asked for yet */
+static bool postcopy_prefetch_wanted(MigrationIncomingState *mis,
+                                     RAMBlock *rb, ram_addr_t start)
+{
+    void *host = rb->host + start;
+
+    if (ramblock_page_is_discarded(rb, start)) {
+        return false;
+    }
+
+    QEMU_LOCK_GUARD(&mis->page_request_mutex);
+    return !ramblock_recv_bitmap_test_byte_offset(rb, start) &&
+           !g_tree_lookup(mis->page_requested, host);
+}
+
+/*
+ * Ask the source for pages that no vCPU is waiting for yet.  Unlike the
+ * faulting pages they are not added to page_requested, so that they are
+ * neither accounted in the latency statistics nor requested again on
+ * recovery.
+ */
+static int postcopy_prefetch_pages(MigrationIncomingState *mis, RAMBlock *rb,
+                                   ram_addr_t start, ram_addr_t len,
+                                   bool stride)
+{
+    trace_postcopy_prefetch_pages(qemu_ram_get_idstr(rb), start, len, stride);
+    return migrate_send_rp_message_req_pages(mis, rb, start, len);
+}
+
+/*
+ * After the page at @offset of @rb was requested, ask for the
+ * x-postcopy-prefetch-pages pages that follow it, and for as many along
+ * the stride if the last faults in @rb were evenly spaced.  The pages
+ * that follow go out as a single ranged request, trimmed at both ends
+ * to the pages that are still missing; the source skips any page in the
+ * middle that it has sent already.  This is best effort, so errors are
+ * left for the next fault request to report.
+ */
+static void postcopy_prefetch(MigrationIncomingState *mis,
+                              PostcopyPrefetchState *pf,
+                              RAMBlock *rb, ram_addr_t offset)
+{
+    uint32_t pages = migrate_postcopy_prefetch_pages();
+    ram_addr_t psize = qemu_ram_pagesize(rb);
+    ram_addr_t window = (ram_addr_t)pages * psize;
+    ram_addr_t start, end, first, last;
+    int64_t stride = 0;
+    int64_t target;
+    uint32_t i;
+
+    if (!pages) {
+        return;
+    }
+    /* The length of a page request is 32 bits on the wire */
+    window = MIN(window, QEMU_ALIGN_DOWN(UINT32_MAX, psize));
+
+    start = offset + psize;
+    end = MIN(offset + psize + window, rb->used_length);
+    if (rb == pf->rb) {
+        stride = (int64_t)offset - (int64_t)pf->last_fault;
+        /* Sequential access: don't ask again for the previous window */
+        if (start < pf->next && pf->next <= end) {
+            start = pf->next;
+        }
+    }
+
+    first = start;
+    last = end;
+    while (first < last && !postcopy_prefetch_wanted(mis, rb, first)) {
+        first += psize;
+    }
+    while (last > first && !postcopy_prefetch_wanted(mis, rb, last - psize)) {
+        last -= psize;
+    }
+    if (first < last) {
+        postcopy_prefetch_pages(mis, rb, first, last - first, false);
+    }
+
+    /* Strides inside the window are already covered by it */
+    if (stride && stride == pf->stride &&
+        (stride < 0 || stride > window)) {
+        target = offset;
+        for (i = 0; i < pages; i++) {
+            target += stride;
+            if (target < 0 || target >= rb->used_length) {
+                break;
+            }
+            if (postcopy_prefetch_wanted(mis, rb, target) &&
+                postcopy_prefetch_pages(mis, rb, target, psize, true)) {
+                break;
+            }
+        }
+    }
+
+    pf->rb = rb;
+    pf->last_fault = offset;
+    pf->stride = stride;
+    pf->next = end;
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    PostcopyPrefetchState prefetch = { };
     struct uffd_msg msg;
     int ret;
     size_t index;
@@ -1071,6 +1234,7 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+            postcopy_prefetch(mis, &prefetch, rb, rb_offset);
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1251,6 +1415,7 @@ static int qemu_ufd_copy_ioctl(MigrationIncomingState *mis, void *host_addr,
                                void *from_addr, uint64_t pagesize, RAMBlock *rb)
 {
     int userfault_fd = mis->userfault_fd;
+    PostcopyPageRequest *req;
     int ret;
 
     if (from_addr) {
@@ -1275,7 +1440,9 @@ static int qemu_ufd_copy_ioctl(MigrationIncomingState *mis, void *host_addr,
          * If this page resolves a page fault for a previous recorded faulted
          * address, take a special note to maintain the requested page list.
          */
-        if (g_tree_lookup(mis->page_requested, host_addr)) {
+        req = g_tree_lookup(mis->page_requested, host_addr);
+        if (req) {
+            mark_postcopy_latency(mis, req);
             g_tree_remove(mis->page_requested, host_addr);
             mis->page_requested_count--;
             trace_postcopy_page_req_del(host_addr, mis->page_requested_count);
@@ -532,6 +532,106 @@ void qemu_put_buffer(QEMUFile *f, const uint8_t *buf, size_t size)
     }
 }
 
+/*
+ * Write @buflen bytes of @buf at @pos in the file, past the buffer and
+ * without moving the position of the stream.  Only files on a seekable
+ * channel support this.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *local_error = NULL;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return;
+    }
+
+    while (buflen > 0) {
+        ret = qio_channel_pwrite(f->ioc, (char *)buf, buflen, pos,
+                                 &local_error);
+        if (ret < 0) {
+            qemu_file_set_error_obj(f, -EIO, local_error);
+            return;
+        }
+        f->total_transferred += ret;
+        buf += ret;
+        buflen -= ret;
+        pos += ret;
+    }
+}
+
+/*
+ * Read @buflen bytes at @pos in the file into @buf, without going through
+ * the buffer or moving the position of the stream.  Returns the number of
+ * bytes read, which is less than @buflen only on error.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen, off_t pos)
+{
+    Error *local_error = NULL;
+    size_t done = 0;
+    ssize_t ret;
+
+    if (f->last_error) {
+        return 0;
+    }
+
+    while (done < buflen) {
+        ret = qio_channel_pread(f->ioc, (char *)buf + done, buflen - done,
+                                pos + done, &local_error);
+        if (ret <= 0) {
+            qemu_file_set_error_obj(f, ret ? -EIO : -EINVAL, local_error);
+            break;
+        }
+        f->total_transferred += ret;
+        done += ret;
+    }
+    return done;
+}
+
+/*
+ * Return the position in the file of the next byte that the stream
+ * writes or reads, or -1 on error.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_error = NULL;
+    off_t ret;
+
+    qemu_fflush(f);
+    if (f->last_error) {
+        return -1;
+    }
+
+    ret = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &local_error);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+        return -1;
+    }
+    /* Data that was read ahead into the buffer is not consumed yet */
+    return ret - (f->buf_size - f->buf_index);
+}
+
+/*
+ * Move the stream to @pos in the file.  Anything that was buffered is
+ * written out, or dropped when reading.
+ */
+void qemu_set_offset(QEMUFile *f, off_t pos)
+{
+    Error *local_error = NULL;
+
+    qemu_fflush(f);
+    if (f->last_error) {
+        return;
+    }
+
+    f->buf_index = 0;
+    f->buf_size = 0;
+    if (qio_channel_io_seek(f->ioc, pos, SEEK_SET, &local_error) < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_error);
+    }
+}
+
 void qemu_put_byte(QEMUFile *f, int v)
 {
     if (f->last_error) {
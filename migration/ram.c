@@ -390,6 +390,8 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(, RAMSrcPageRequest) src_page_requests;
+    /* Helper threads of the dirty bitmap sync, NULL if it is serial */
+    struct BitmapSyncPool *bitmap_sync_pool;
 };
 typedef struct RAMState RAMState;
 
@@ -902,6 +904,224 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * With several threads, the word aligned part of each large RAMBlock is
+ * split in chunks of this size that are merged in parallel.  Chunks cover
+ * whole words of RAMBlock::bmap, so no two threads write the same word.
+ */
+#define BITMAP_SYNC_CHUNK_SIZE  (1ULL << 26)
+
+typedef struct {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} BitmapSyncChunk;
+
+typedef struct {
+    BitmapSyncChunk *chunks;
+    unsigned nr_chunks;
+    /* Index of the next chunk to take, updated atomically */
+    unsigned next;
+} BitmapSyncWork;
+
+typedef struct {
+    QemuThread thread;
+    struct BitmapSyncPool *pool;
+    /* Pages found dirty by this thread, reset by the migration thread */
+    uint64_t new_dirty_pages;
+} BitmapSyncWorker;
+
+/*
+ * The helpers are started with RAMState and wait between two syncs, so
+ * that a sync only costs a post and a wait per helper.
+ */
+typedef struct BitmapSyncPool {
+    BitmapSyncWorker *workers;
+    unsigned nr_workers;
+    /* The sync in progress */
+    BitmapSyncWork *work;
+    /* Posted once per helper that should join the sync in progress */
+    QemuSemaphore sem_start;
+    /* Posted back once per sem_start, when no chunk is left */
+    QemuSemaphore sem_done;
+    bool quit;
+} BitmapSyncPool;
+
+/* Called with RCU critical section */
+static uint64_t bitmap_sync_work_run(BitmapSyncWork *work)
+{
+    uint64_t new_dirty_pages = 0;
+    unsigned i;
+
+    while ((i = qatomic_fetch_inc(&work->next)) < work->nr_chunks) {
+        BitmapSyncChunk *chunk = &work->chunks[i];
+
+        new_dirty_pages += cpu_physical_memory_sync_dirty_words(chunk->block,
+                                                                chunk->start,
+                                                                chunk->length);
+    }
+    return new_dirty_pages;
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    BitmapSyncWorker *worker = opaque;
+    BitmapSyncPool *pool = worker->pool;
+
+    rcu_register_thread();
+    for (;;) {
+        qemu_sem_wait(&pool->sem_start);
+        if (qatomic_read(&pool->quit)) {
+            break;
+        }
+        /*
+         * The same helper may take two posts of one sync; the second
+         * finds no chunk left and only posts sem_done back.
+         */
+        WITH_RCU_READ_LOCK_GUARD() {
+            worker->new_dirty_pages += bitmap_sync_work_run(pool->work);
+        }
+        qemu_sem_post(&pool->sem_done);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void bitmap_sync_threads_setup(RAMState *rs)
+{
+    unsigned threads = migrate_bitmap_sync_threads();
+    BitmapSyncPool *pool;
+    unsigned i;
+
+    if (threads <= 1) {
+        return;
+    }
+
+    pool = g_new0(BitmapSyncPool, 1);
+    pool->nr_workers = threads - 1;
+    pool->workers = g_new0(BitmapSyncWorker, pool->nr_workers);
+    qemu_sem_init(&pool->sem_start, 0);
+    qemu_sem_init(&pool->sem_done, 0);
+    for (i = 0; i < pool->nr_workers; i++) {
+        pool->workers[i].pool = pool;
+        qemu_thread_create(&pool->workers[i].thread, "bitmap_sync",
+                           bitmap_sync_thread, &pool->workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    rs->bitmap_sync_pool = pool;
+}
+
+static void bitmap_sync_threads_cleanup(RAMState *rs)
+{
+    BitmapSyncPool *pool = rs->bitmap_sync_pool;
+    unsigned i;
+
+    if (!pool) {
+        return;
+    }
+
+    qatomic_set(&pool->quit, true);
+    for (i = 0; i < pool->nr_workers; i++) {
+        qemu_sem_post(&pool->sem_start);
+    }
+    for (i = 0; i < pool->nr_workers; i++) {
+        qemu_thread_join(&pool->workers[i].thread);
+    }
+    qemu_sem_destroy(&pool->sem_start);
+    qemu_sem_destroy(&pool->sem_done);
+    g_free(pool->workers);
+    g_free(pool);
+    rs->bitmap_sync_pool = NULL;
+}
+
+/*
+ * Same as calling ramblock_sync_dirty_bitmap() on every RAMBlock, but
+ * with the bulk of the work shared between the calling thread and the
+ * helpers of rs->bitmap_sync_pool.  RAMBlocks that are too small or not
+ * aligned to a word of the dirty bitmap are still synced by the caller.
+ *
+ * Called with RCU critical section and bitmap_mutex held
+ */
+static void ram_sync_dirty_bitmap_parallel(RAMState *rs)
+{
+    const ram_addr_t word_size = BITS_PER_LONG << TARGET_PAGE_BITS;
+    BitmapSyncPool *pool = rs->bitmap_sync_pool;
+    g_autoptr(GArray) chunks = g_array_new(false, false,
+                                           sizeof(BitmapSyncChunk));
+    BitmapSyncWork work = { };
+    uint64_t new_dirty_pages;
+    RAMBlock *block;
+    unsigned helpers, i;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t aligned = QEMU_ALIGN_DOWN(block->used_length, word_size);
+        ram_addr_t start;
+
+        if (!block->clear_bmap || aligned < 2 * BITMAP_SYNC_CHUNK_SIZE ||
+            !cpu_physical_memory_sync_dirty_aligned(block, 0, aligned)) {
+            ramblock_sync_dirty_bitmap(rs, block);
+            continue;
+        }
+
+        for (start = 0; start < aligned; start += BITMAP_SYNC_CHUNK_SIZE) {
+            BitmapSyncChunk chunk = {
+                .block = block,
+                .start = start,
+                .length = MIN(BITMAP_SYNC_CHUNK_SIZE, aligned - start),
+            };
+            g_array_append_val(chunks, chunk);
+        }
+
+        /* The unaligned tail goes through the per-page slow path */
+        if (aligned < block->used_length) {
+            new_dirty_pages =
+                cpu_physical_memory_sync_dirty_bitmap(block, aligned,
+                                                      block->used_length -
+                                                      aligned);
+            rs->migration_dirty_pages += new_dirty_pages;
+            rs->num_dirty_pages_period += new_dirty_pages;
+        }
+    }
+
+    if (!chunks->len) {
+        return;
+    }
+
+    work.chunks = &g_array_index(chunks, BitmapSyncChunk, 0);
+    work.nr_chunks = chunks->len;
+    helpers = MIN(pool->nr_workers, chunks->len - 1);
+    trace_migration_bitmap_sync_parallel(helpers + 1, chunks->len);
+
+    pool->work = &work;
+    for (i = 0; i < pool->nr_workers; i++) {
+        pool->workers[i].new_dirty_pages = 0;
+    }
+    for (i = 0; i < helpers; i++) {
+        qemu_sem_post(&pool->sem_start);
+    }
+
+    new_dirty_pages = bitmap_sync_work_run(&work);
+
+    for (i = 0; i < helpers; i++) {
+        qemu_sem_wait(&pool->sem_done);
+    }
+    for (i = 0; i < pool->nr_workers; i++) {
+        new_dirty_pages += pool->workers[i].new_dirty_pages;
+    }
+    pool->work = NULL;
+
+    /* clear_bmap is not per word: set it only once all threads are done */
+    for (i = 0; i < work.nr_chunks; i++) {
+        BitmapSyncChunk *chunk = &work.chunks[i];
+
+        clear_bmap_set(chunk->block, chunk->start >> TARGET_PAGE_BITS,
+                       chunk->length >> TARGET_PAGE_BITS);
+    }
+
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1027,8 +1247,12 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     WITH_RCU_READ_LOCK_GUARD() {
-        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-            ramblock_sync_dirty_bitmap(rs, block);
+        if (rs->bitmap_sync_pool) {
+            ram_sync_dirty_bitmap_parallel(rs);
+        } else {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                ramblock_sync_dirty_bitmap(rs, block);
+            }
         }
         stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
     }
@@ -1134,6 +1358,91 @@ static int save_zero_page(PageSearchStatus *pss, QEMUFile *f, RAMBlock *block,
     return -1;
 }
 
+/*
+ * With mapped-ram, each RAMBlock gets a fixed region of the file, after
+ * its entry in the RAM_SAVE_FLAG_MEM_SIZE list:
+ *
+ *   header: version (be32), page size (be64), bitmap and pages offsets
+ *           (be64 each, from the start of the file)
+ *   bitmap: one bit per target page, little endian, set when the page is
+ *           in the file
+ *   pages:  the block's pages at their offset in the block, aligned to
+ *           MAPPED_RAM_FILE_OFFSET_ALIGNMENT
+ *
+ * The stream itself skips over the region and continues after it.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+/* Size in the file of the bitmap for @pages pages */
+static size_t mapped_ram_bitmap_size(unsigned long pages)
+{
+    return ROUND_UP(pages, 64) / BITS_PER_BYTE;
+}
+
+static void mapped_ram_setup_ramblock(QEMUFile *f, RAMBlock *block)
+{
+    unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+    off_t header_end;
+
+    block->file_bmap = bitmap_new(ROUND_UP(pages, 64));
+
+    header_end = qemu_get_offset(f) + sizeof(uint32_t) + 3 * sizeof(uint64_t);
+    block->bitmap_offset = header_end;
+    block->pages_offset = ROUND_UP(header_end + mapped_ram_bitmap_size(pages),
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    qemu_put_be32(f, MAPPED_RAM_HDR_VERSION);
+    qemu_put_be64(f, TARGET_PAGE_SIZE);
+    qemu_put_be64(f, block->bitmap_offset);
+    qemu_put_be64(f, block->pages_offset);
+
+    /* Leave room for the bitmap and the pages */
+    qemu_set_offset(f, block->pages_offset + block->used_length);
+}
+
+/* Write out the final bitmap of each RAMBlock, once all pages are saved */
+static void mapped_ram_save_bitmaps(QEMUFile *f)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        g_autofree unsigned long *le_bmap = bitmap_new(ROUND_UP(pages, 64));
+
+        bitmap_to_le(le_bmap, block->file_bmap, ROUND_UP(pages, 64));
+        qemu_put_buffer_at(f, (uint8_t *)le_bmap,
+                           mapped_ram_bitmap_size(pages),
+                           block->bitmap_offset);
+    }
+}
+
+/*
+ * save_mapped_ram_page: write a page at its place in the file
+ *
+ * Zero pages are not written, only dropped from the file bitmap in case
+ * an earlier iteration had written them; the destination starts from
+ * zeroed RAM.  Returns the number of pages saved.
+ */
+static int save_mapped_ram_page(QEMUFile *f, RAMBlock *block,
+                                ram_addr_t offset)
+{
+    uint8_t *p = block->host + offset;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+
+    if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        clear_bit(page, block->file_bmap);
+        stat64_add(&mig_stats.zero_pages, 1);
+        return 1;
+    }
+
+    qemu_put_buffer_at(f, p, TARGET_PAGE_SIZE, block->pages_offset + offset);
+    set_bit(page, block->file_bmap);
+    ram_transferred_add(TARGET_PAGE_SIZE);
+    stat64_add(&mig_stats.normal_pages, 1);
+    return 1;
+}
+
 /*
  * @pages: the number of pages written by the control path,
  *        < 0 - error
@@ -1254,7 +1563,7 @@ static int ram_save_multifd_page(QEMUFile *file, RAMBlock *block,
     if (multifd_queue_page(file, block, offset) < 0) {
         return -1;
     }
-    stat64_add(&mig_stats.normal_pages, 1);
+    /* The channel thread accounts the page as normal or zero */
 
     return 1;
 }
@@ -2089,16 +2398,34 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(pss, block, offset, &res)) {
         return res;
     }
 
+    if (migrate_mapped_ram()) {
+        return save_mapped_ram_page(pss->pss_channel, block, offset);
+    }
+
     if (save_compress_page(rs, pss, block, offset)) {
         return 1;
     }
 
+    /*
+     * Do not use multifd in postcopy as one whole host page should be
+     * placed.  Meanwhile postcopy requires atomic update of pages, so even
+     * if host page size == guest page size the dest guest during run may
+     * still see partially copied pages which is data corruption.
+     */
+    use_multifd = migrate_multifd() && !migration_in_postcopy();
+
+    /* multifd channels look for zero pages themselves */
+    if (use_multifd && migrate_multifd_zero_page()) {
+        return ram_save_multifd_page(pss->pss_channel, block, offset);
+    }
+
     res = save_zero_page(pss, pss->pss_channel, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
@@ -2112,13 +2439,7 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return res;
     }
 
-    /*
-     * Do not use multifd in postcopy as one whole host page should be
-     * placed.  Meanwhile postcopy requires atomic update of pages, so even
-     * if host page size == guest page size the dest guest during run may
-     * still see partially copied pages which is data corruption.
-     */
-    if (migrate_multifd() && !migration_in_postcopy()) {
+    if (use_multifd) {
         return ram_save_multifd_page(pss->pss_channel, block, offset);
     }
 
@@ -2416,6 +2737,7 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        bitmap_sync_threads_cleanup(*rsp);
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2465,6 +2787,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2795,6 +3119,7 @@ static int ram_state_init(RAMState **rsp)
      */
     (*rsp)->migration_dirty_pages = (*rsp)->ram_bytes_total >> TARGET_PAGE_BITS;
     ram_state_reset(*rsp);
+    bitmap_sync_threads_setup(*rsp);
 
     return 0;
 }
@@ -3021,6 +3346,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3212,6 +3540,10 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         ram_flush_compressed_data(rs);
         ram_control_after_iterate(f, RAM_CONTROL_FINISH);
+
+        if (!ret && migrate_mapped_ram()) {
+            mapped_ram_save_bitmaps(f);
+        }
     }
 
     if (ret < 0) {
@@ -3432,6 +3764,87 @@ void ram_handle_compressed(void *host, uint8_t ch, uint64_t size)
     }
 }
 
+/*
+ * Read the pages of @block that the mapped-ram region of the file holds,
+ * one read per run of consecutive pages, and move the stream past the
+ * region.  @length is the size of the block on the source.
+ */
+static int ram_load_mapped_ram(QEMUFile *f, RAMBlock *block,
+                               ram_addr_t length)
+{
+    unsigned long pages = length >> TARGET_PAGE_BITS;
+    g_autofree unsigned long *bitmap = bitmap_new(ROUND_UP(pages, 64));
+    bool is_rom = memory_region_is_rom(block->mr) ||
+                  memory_region_is_romd(block->mr);
+    size_t bitmap_size = mapped_ram_bitmap_size(pages);
+    uint32_t version;
+    uint64_t page_size, bitmap_offset, pages_offset;
+    unsigned long set, clear = 0;
+
+    version = qemu_get_be32(f);
+    page_size = qemu_get_be64(f);
+    bitmap_offset = qemu_get_be64(f);
+    pages_offset = qemu_get_be64(f);
+
+    if (version != MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram version %" PRIu32
+                     " for block %s", version, block->idstr);
+        return -EINVAL;
+    }
+    if (page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size %" PRIu64
+                     " for block %s", page_size, block->idstr);
+        return -EINVAL;
+    }
+
+    if (qemu_get_buffer_at(f, (uint8_t *)bitmap, bitmap_size,
+                           bitmap_offset) != bitmap_size) {
+        return qemu_file_get_error(f);
+    }
+    bitmap_from_le(bitmap, bitmap, ROUND_UP(pages, 64));
+
+    for (set = find_first_bit(bitmap, pages); set < pages;
+         set = find_next_bit(bitmap, pages, clear)) {
+        ram_addr_t offset = (ram_addr_t)set << TARGET_PAGE_BITS;
+        size_t len;
+        void *host;
+
+        /*
+         * Pages that are not in the file are zero.  RAM is still zeroed,
+         * but ROMs were loaded at machine init.
+         */
+        if (is_rom && set > clear) {
+            ram_handle_compressed(block->host +
+                                  ((ram_addr_t)clear << TARGET_PAGE_BITS),
+                                  0, (ram_addr_t)(set - clear) <<
+                                     TARGET_PAGE_BITS);
+        }
+
+        clear = find_next_zero_bit(bitmap, pages, set + 1);
+        len = (size_t)(clear - set) << TARGET_PAGE_BITS;
+        host = host_from_ram_block_offset(block, offset);
+        if (!host) {
+            error_report("Illegal RAM offset " RAM_ADDR_FMT, offset);
+            return -EINVAL;
+        }
+
+        if (qemu_get_buffer_at(f, host, len, pages_offset + offset) != len) {
+            return qemu_file_get_error(f);
+        }
+        ramblock_recv_bitmap_set_range(block, host, clear - set);
+        trace_ram_load_mapped_ram(block->idstr, offset, len);
+    }
+    if (is_rom && pages > clear) {
+        ram_handle_compressed(block->host +
+                              ((ram_addr_t)clear << TARGET_PAGE_BITS),
+                              0, (ram_addr_t)(pages - clear) <<
+                                 TARGET_PAGE_BITS);
+    }
+
+    qemu_set_offset(f, pages_offset + length);
+    return qemu_file_get_error(f);
+}
+
 static void colo_init_ram_state(void)
 {
     ram_state_init(&ram_state);
@@ -3966,6 +4379,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = ram_load_mapped_ram(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -15,10 +15,72 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
+#if defined(CONFIG_AVX2_OPT) || defined(__aarch64__)
+/*
+ * Find the first byte at or after @i that is (@skip_same) or is not
+ * (@skip_diff) identical in both buffers; both return @slen if none.
+ */
+typedef int (*xbzrle_scan_fn)(const uint8_t *old_buf, const uint8_t *new_buf,
+                              int i, int slen);
+
+/*
+ * Run-length encoder shared by the vector implementations.  It is inlined
+ * into each of them, so the scan functions are inlined too and get to use
+ * the instruction set of the caller.  The output is identical to the one
+ * of the generic encoder below.
+ */
+static inline __attribute__((always_inline)) int
+xbzrle_encode_runs(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                   uint8_t *dst, int dlen,
+                   xbzrle_scan_fn skip_same, xbzrle_scan_fn skip_diff)
+{
+    int d = 0, i = 0;
+
+    while (i < slen) {
+        int start = i;
+        uint32_t len;
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        i = skip_same(old_buf, new_buf, i, slen);
+
+        /* skip last zero run, this also covers an unchanged buffer */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, i - start);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = skip_diff(old_buf, new_buf, i, slen);
+        len = i - start;
+
+        d += uleb128_encode_small(dst + d, len);
+        /* overflow */
+        if (d + len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, len);
+        d += len;
+    }
+
+    return d;
+}
+#endif
+
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
 #include <immintrin.h>
 #include "host/cpuinfo.h"
 
+#ifdef CONFIG_AVX512BW_OPT
 static int __attribute__((target("avx512bw")))
 xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
                             uint8_t *dst, int dlen)
@@ -137,19 +199,103 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+#endif /* CONFIG_AVX512BW_OPT */
+
+#ifdef CONFIG_AVX2_OPT
+static inline int __attribute__((target("avx2")))
+xbzrle_skip_same_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                      int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        __m256i o = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i n = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+        if (eq != UINT32_MAX) {
+            return i + ctz32(~eq);
+        }
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int __attribute__((target("avx2")))
+xbzrle_skip_diff_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                      int i, int slen)
+{
+    for (; i + 32 <= slen; i += 32) {
+        __m256i o = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i n = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_skip_same_avx2, xbzrle_skip_diff_avx2);
+}
+#endif /* CONFIG_AVX2_OPT */
+
 static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
                                     int slen, uint8_t *dst, int dlen);
 
+static unsigned used_accel;
 static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
 
-static void __attribute__((constructor)) init_accel(void)
+static unsigned __attribute__((noinline))
+select_accel_cpuinfo(unsigned info)
 {
-    unsigned info = cpuinfo_init();
-    if (info & CPUINFO_AVX512BW) {
-        accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int);
+    } all[] = {
+#ifdef CONFIG_AVX512BW_OPT
+        { CPUINFO_AVX512BW, xbzrle_encode_buffer_avx512 },
+#endif
+#ifdef CONFIG_AVX2_OPT
+        { CPUINFO_AVX2,     xbzrle_encode_buffer_avx2 },
+#endif
+        { CPUINFO_ALWAYS,   xbzrle_encode_buffer_int },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        if (info & all[i].bit) {
+            accel_func = all[i].fn;
+            return all[i].bit;
+        }
     }
+    return 0;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /*
+     * Accumulate the accelerators that we've already tested, and
+     * remove them from the set to test this round.  We'll get back
+     * a zero from select_accel_cpuinfo when there are no more.
+     */
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+    used_accel |= used;
+    return used;
 }
 
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -159,6 +305,83 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 }
 
 #define xbzrle_encode_buffer xbzrle_encode_buffer_int
+
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+/*
+ * Compare 16 bytes and narrow the 0x00/0xff result to one nibble per
+ * byte, so that byte n of the vector is bits [4n, 4n + 3] of the result.
+ */
+static inline uint64_t xbzrle_eq_mask_neon(const uint8_t *old_buf,
+                                           const uint8_t *new_buf)
+{
+    uint8x16_t eq = vceqq_u8(vld1q_u8(old_buf), vld1q_u8(new_buf));
+    uint8x8_t nib = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+
+    return vget_lane_u64(vreinterpret_u64_u8(nib), 0);
+}
+
+static inline int xbzrle_skip_same_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    for (; i + 16 <= slen; i += 16) {
+        uint64_t eq = xbzrle_eq_mask_neon(old_buf + i, new_buf + i);
+
+        if (eq != UINT64_MAX) {
+            return i + ctz64(~eq) / 4;
+        }
+    }
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline int xbzrle_skip_diff_neon(const uint8_t *old_buf,
+                                        const uint8_t *new_buf,
+                                        int i, int slen)
+{
+    for (; i + 16 <= slen; i += 16) {
+        uint64_t eq = xbzrle_eq_mask_neon(old_buf + i, new_buf + i);
+
+        if (eq) {
+            return i + ctz64(eq) / 4;
+        }
+    }
+    while (i < slen && old_buf[i] != new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen);
+
+/* Advanced SIMD is architecturally guaranteed, so there is nothing to pick. */
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    if (unlikely(slen < 16)) {
+        return xbzrle_encode_buffer_int(old_buf, new_buf, slen, dst, dlen);
+    }
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              xbzrle_skip_same_neon, xbzrle_skip_diff_neon);
+}
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    return false;
+}
+
+#define xbzrle_encode_buffer xbzrle_encode_buffer_int
+
+#else
+bool test_xbzrle_encode_next_accel(void)
+{
+    return false;
+}
 #endif
 
 /*
@@ -19,4 +19,11 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
+/*
+ * Switch xbzrle_encode_buffer() to the next accelerated implementation
+ * supported by the host, returning false once all of them have been
+ * selected.  For use by tests and benchmarks only.
+ */
+bool test_xbzrle_encode_next_accel(void);
+
 #endif
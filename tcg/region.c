@@ -61,6 +61,8 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t seq; /* allocation counter */
+    uint64_t *alloc_seq; /* per region: .seq when allocated, 0 if free */
 };
 
 static struct tcg_region_state region;
@@ -168,10 +170,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Return the index of the region containing @p, in the rw buffer. */
+static size_t tc_ptr_to_region_idx(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -182,19 +197,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
             return NULL;
         }
     }
-
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tc_ptr_to_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -332,15 +335,25 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_ptr = start;
     s->code_gen_buffer_size = end - start;
     s->code_gen_highwater = end - TCG_HIGHWATER;
+    region.alloc_seq[curr_region] = ++region.seq;
 }
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t i = region.current;
+
+    if (i == region.n) {
+        /* Fall back to any region released by tcg_region_evict() */
+        for (i = 0; i < region.n && region.alloc_seq[i]; i++) {
+            continue;
+        }
+        if (i == region.n) {
+            return true;
+        }
+    } else {
+        region.current++;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, i);
     return false;
 }
 
@@ -389,6 +402,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.seq = 0;
+    memset(region.alloc_seq, 0, region.n * sizeof(*region.alloc_seq));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -399,6 +414,81 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+static bool tcg_region_in_use__locked(size_t i, unsigned int n_ctxs)
+{
+    unsigned int j;
+
+    for (j = 0; j < n_ctxs; j++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[j]);
+
+        if (tc_ptr_to_region_idx(s->code_gen_buffer) == i) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Return the least recently allocated region no context is filling. */
+static size_t tcg_region_oldest__locked(unsigned int n_ctxs)
+{
+    size_t i, oldest = region.n;
+
+    for (i = 0; i < region.n; i++) {
+        if (region.alloc_seq[i] &&
+            (oldest == region.n ||
+             region.alloc_seq[i] < region.alloc_seq[oldest]) &&
+            !tcg_region_in_use__locked(i, n_ctxs)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+static void tcg_region_evict__locked(size_t i, GTraverseFunc func,
+                                     gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + i * tree_size;
+    void *start, *end;
+
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(i, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    region.alloc_seq[i] = 0;
+}
+
+/*
+ * Release the oldest quarter of the regions that are not assigned to any
+ * context, calling @func on each of their TBs first so that the caller can
+ * unlink them.  Returns the number of regions released, which is 0 if every
+ * region is in use (e.g. when there is only one).
+ *
+ * Call from a safe-work context.
+ */
+size_t tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    size_t want = MAX(region.n / 4, 1);
+    size_t done;
+
+    qemu_mutex_lock(&region.lock);
+    for (done = 0; done < want; done++) {
+        size_t i = tcg_region_oldest__locked(n_ctxs);
+
+        if (i == region.n) {
+            break;
+        }
+        tcg_region_evict__locked(i, func, user_data);
+    }
+    qemu_mutex_unlock(&region.lock);
+    return done;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -412,9 +502,13 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
+    /*
+     * With a single vCPU thread there is no parallel code generation, but
+     * a few regions still let tcg_region_evict() free part of the buffer
+     * instead of flushing all of it.
+     */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return MAX(MIN(tb_size / (2 * MiB), 8), 1);
     }
 
     /*
@@ -711,7 +805,8 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * code in parallel without synchronization.
  *
  * In softmmu the number of TCG threads is bounded by max_cpus, so we use at
- * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * least max_cpus regions in MTTCG. In !MTTCG we use a handful of regions,
+ * which only serve to age translated code for tcg_region_evict().
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
@@ -787,6 +882,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.alloc_seq = g_new0(uint64_t, region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
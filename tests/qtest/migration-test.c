@@ -216,6 +216,9 @@ static void read_blocktime(QTestState *who)
 
     rsp_return = migrate_query_not_failed(who);
     g_assert(qdict_haskey(rsp_return, "postcopy-blocktime"));
+    g_assert(qdict_haskey(rsp_return, "postcopy-latency"));
+    g_assert(!qlist_empty(qdict_get_qlist(rsp_return,
+                                          "postcopy-latency-dist")));
     qobject_unref(rsp_return);
 }
 
@@ -778,6 +781,7 @@ static void test_migrate_end(QTestState *from, QTestState *to, bool test_dest)
 
     cleanup("bootsect");
     cleanup("migsocket");
+    cleanup("migfile");
     cleanup("src_serial");
     cleanup("dest_serial");
 }
@@ -1249,6 +1253,29 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void test_postcopy_prefetch(void)
+{
+    MigrateCommon args = {
+        .start = {
+            .opts_target = "-global migration.x-postcopy-prefetch-pages=8",
+        },
+    };
+
+    test_postcopy_common(&args);
+}
+
+static void test_postcopy_preempt_prefetch(void)
+{
+    MigrateCommon args = {
+        .start = {
+            .opts_target = "-global migration.x-postcopy-prefetch-pages=8",
+        },
+        .postcopy_preempt = true,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -1479,6 +1506,26 @@ static void test_precopy_unix_plain(void)
     test_precopy_common(&args);
 }
 
+/*
+ * Guest RAM is larger than two sync chunks, so the dirty bitmap is merged
+ * by the helper threads.  A dirty page that they missed would not be sent
+ * again, and the destination would fail check_guests_ram().
+ */
+static void test_precopy_unix_bitmap_sync_threads(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .start = {
+            .opts_source = "-global migration.x-bitmap-sync-threads=4",
+        },
+        .listen_uri = uri,
+        .connect_uri = uri,
+        /* Go through a few syncs before converging */
+        .iterations = 3,
+    };
+
+    test_precopy_common(&args);
+}
 
 static void test_precopy_unix_dirty_ring(void)
 {
@@ -1639,6 +1686,65 @@ static void test_precopy_unix_compress_nowait(void)
     test_precopy_common(&args);
 }
 
+static void do_test_precopy_file(bool mapped_ram)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    MigrateStart args = {};
+    QTestState *from, *to;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    if (mapped_ram) {
+        migrate_set_capability(from, "mapped-ram", true);
+        migrate_set_capability(to, "mapped-ram", true);
+    }
+
+    /*
+     * File migration is never live: the destination can only start
+     * reading once the source has written the whole stream.  With
+     * mapped-ram, go through a few passes first so that pages get
+     * rewritten in place.
+     */
+    if (mapped_ram) {
+        migrate_ensure_non_converge(from);
+    } else {
+        migrate_ensure_converge(from);
+    }
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, uri, "{}");
+    if (mapped_ram) {
+        wait_for_migration_pass(from);
+        wait_for_migration_pass(from);
+        migrate_ensure_converge(from);
+    }
+    wait_for_migration_complete(from);
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", uri);
+    qobject_unref(rsp);
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+}
+
+static void test_precopy_file(void)
+{
+    do_test_precopy_file(false);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    do_test_precopy_file(true);
+}
+
 static void test_precopy_tcp_plain(void)
 {
     MigrateCommon args = {
@@ -2647,6 +2753,10 @@ int main(int argc, char **argv)
         qtest_add_func("/migration/postcopy/preempt/plain", test_postcopy_preempt);
         qtest_add_func("/migration/postcopy/preempt/recovery/plain",
                        test_postcopy_preempt_recovery);
+        qtest_add_func("/migration/postcopy/prefetch/plain",
+                       test_postcopy_prefetch);
+        qtest_add_func("/migration/postcopy/preempt/prefetch/plain",
+                       test_postcopy_preempt_prefetch);
         if (getenv("QEMU_TEST_FLAKY_TESTS")) {
             qtest_add_func("/migration/postcopy/compress/plain",
                            test_postcopy_compress);
@@ -2657,7 +2767,12 @@ int main(int argc, char **argv)
 
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
+    qtest_add_func("/migration/precopy/unix/bitmap-sync-threads",
+                   test_precopy_unix_bitmap_sync_threads);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/file", test_precopy_file);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
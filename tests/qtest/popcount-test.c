@@ -0,0 +1,498 @@
+/*
+ * QTest testcase for the popcount accelerator and its AXI DMA front end
+ * on the virt machine.
+ *
+ * Run with "-m perf" to also measure MM2S throughput from 4 KiB to 64 MiB.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/crc32c.h"
+#include "qemu/host-utils.h"
+#include "qemu/units.h"
+#include "libqtest.h"
+#include "migration-helpers.h"
+
+#define POPCOUNT_BASE       0x40000000
+#define RAM_BASE            0x60000000
+
+/* Core registers */
+#define POP_RESET           (POPCOUNT_BASE + 0x0)
+#define POP_DATA            (POPCOUNT_BASE + 0x4)
+
+/* AXI DMA registers */
+#define DMA_BASE            (POPCOUNT_BASE + 0x1000)
+#define MM2S_DMACR          (DMA_BASE + 0x00)
+#define MM2S_DMASR          (DMA_BASE + 0x04)
+#define MM2S_CURDESC        (DMA_BASE + 0x08)
+#define MM2S_CURDESC_MSB    (DMA_BASE + 0x0C)
+#define MM2S_TAILDESC       (DMA_BASE + 0x10)
+#define MM2S_TAILDESC_MSB   (DMA_BASE + 0x14)
+#define MM2S_SA             (DMA_BASE + 0x18)
+#define MM2S_LENGTH         (DMA_BASE + 0x28)
+#define S2MM_DMACR          (DMA_BASE + 0x30)
+#define S2MM_DMASR          (DMA_BASE + 0x34)
+#define S2MM_DA             (DMA_BASE + 0x48)
+#define S2MM_LENGTH         (DMA_BASE + 0x58)
+
+#define DMACR_RS            (1 << 0)
+#define DMACR_RESET         (1 << 2)
+#define DMACR_IOC_IRQ_EN    (1 << 12)
+#define DMASR_HALTED        (1 << 0)
+#define DMASR_IDLE          (1 << 1)
+#define DMASR_SG_INCLD      (1 << 3)
+#define DMASR_DMA_INT_ERR   (1 << 4)
+#define DMASR_IOC_IRQ       (1 << 12)
+#define DMASR_ERR_IRQ       (1 << 14)
+
+/* Scatter-gather descriptors */
+#define DESC_NXTDESC        0x00
+#define DESC_BUFFER_ADDRESS 0x08
+#define DESC_CONTROL        0x18
+#define DESC_STATUS         0x1C
+#define DESC_ALIGN          0x40
+#define CTRL_TXEOF          (1u << 26)
+#define CTRL_TXSOF          (1u << 27)
+#define STS_CMPLT           (1u << 31)
+
+/* Guest RAM layout used by the tests */
+#define SRC_ADDR            (RAM_BASE + 0x00100000)
+#define DESC_ADDR           (RAM_BASE + 0x00080000)
+#define DST_ADDR            (RAM_BASE + 0x00090000)
+#define HIGH_DESC_ADDR      0x100080000ULL  /* needs -m 3G */
+
+static void wait_idle(QTestState *qts, uint64_t sr)
+{
+    gint64 end = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+
+    while (!(qtest_readl(qts, sr) & DMASR_IDLE)) {
+        g_assert_cmpint(g_get_monotonic_time(), <, end);
+        g_usleep(10);
+    }
+}
+
+static uint32_t fill_random(QTestState *qts, uint64_t addr, size_t len)
+{
+    g_autofree uint8_t *buf = g_malloc(len);
+    uint32_t bits = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = g_test_rand_int();
+        bits += ctpop8(buf[i]);
+    }
+    qtest_bufwrite(qts, addr, buf, len);
+    return bits;
+}
+
+static void mm2s_simple(QTestState *qts, uint64_t addr, uint32_t len)
+{
+    qtest_writel(qts, MM2S_SA, addr);
+    qtest_writel(qts, MM2S_LENGTH, len);
+}
+
+static void test_reset_values(void)
+{
+    QTestState *qts = qtest_init("-machine virt");
+
+    g_assert_cmphex(qtest_readl(qts, POP_DATA), ==, 0);
+    g_assert_cmphex(qtest_readl(qts, MM2S_DMACR), ==, 0x00010000);
+    g_assert_cmphex(qtest_readl(qts, MM2S_DMASR), ==,
+                    DMASR_HALTED | DMASR_SG_INCLD);
+    g_assert_cmphex(qtest_readl(qts, S2MM_DMACR), ==, 0x00010000);
+    g_assert_cmphex(qtest_readl(qts, S2MM_DMASR), ==, DMASR_HALTED);
+
+    qtest_quit(qts);
+}
+
+static void test_data_port(void)
+{
+    QTestState *qts = qtest_init("-machine virt");
+    uint32_t bits = 0;
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t v = g_test_rand_int();
+
+        qtest_writel(qts, POP_DATA, v);
+        bits += ctpop32(v);
+    }
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, bits);
+
+    /* Writing zero to the reset register does nothing */
+    qtest_writel(qts, POP_RESET, 0);
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, bits);
+    qtest_writel(qts, POP_RESET, 1);
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_mm2s_simple(void)
+{
+    QTestState *qts = qtest_init("-machine virt");
+    uint32_t head = fill_random(qts, SRC_ADDR, 4 * KiB);
+    uint32_t bits = head + fill_random(qts, SRC_ADDR + 4 * KiB, 60 * KiB);
+    uint32_t sr;
+
+    /* A transfer on a halted channel is refused */
+    mm2s_simple(qts, SRC_ADDR, 64 * KiB);
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, 0);
+
+    qtest_writel(qts, MM2S_DMACR, DMACR_RS | DMACR_IOC_IRQ_EN);
+    mm2s_simple(qts, SRC_ADDR, 64 * KiB);
+    wait_idle(qts, MM2S_DMASR);
+
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, bits);
+    sr = qtest_readl(qts, MM2S_DMASR);
+    g_assert_cmphex(sr & (DMASR_HALTED | DMASR_IOC_IRQ | DMASR_ERR_IRQ), ==,
+                    DMASR_IOC_IRQ);
+
+    /* IOC is write-1-to-clear */
+    qtest_writel(qts, MM2S_DMASR, DMASR_IOC_IRQ);
+    g_assert_false(qtest_readl(qts, MM2S_DMASR) & DMASR_IOC_IRQ);
+
+    /* Counts accumulate until the core is reset */
+    mm2s_simple(qts, SRC_ADDR, 4 * KiB);
+    wait_idle(qts, MM2S_DMASR);
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, bits + head);
+
+    /* A soft reset halts the channel again */
+    qtest_writel(qts, MM2S_DMACR, DMACR_RESET);
+    g_assert_cmphex(qtest_readl(qts, MM2S_DMASR), ==,
+                    DMASR_HALTED | DMASR_SG_INCLD);
+
+    qtest_quit(qts);
+}
+
+static void write_desc(QTestState *qts, uint64_t desc, uint64_t next,
+                       uint64_t buf, uint32_t ctrl)
+{
+    qtest_writeq(qts, desc + DESC_NXTDESC, next);
+    qtest_writeq(qts, desc + DESC_BUFFER_ADDRESS, buf);
+    qtest_writel(qts, desc + DESC_CONTROL, ctrl);
+    qtest_writel(qts, desc + DESC_STATUS, 0);
+}
+
+static void test_mm2s_sg(void)
+{
+    static const uint32_t lens[] = { 1000, 2048, 4096, 12 };
+    QTestState *qts = qtest_init("-machine virt");
+    uint32_t bits = 0;
+    int n = ARRAY_SIZE(lens);
+
+    for (int i = 0; i < n; i++) {
+        uint64_t desc = DESC_ADDR + i * DESC_ALIGN;
+        uint64_t buf = SRC_ADDR + i * 4 * KiB;
+        uint32_t ctrl = lens[i];
+
+        if (i == 0) {
+            ctrl |= CTRL_TXSOF;
+        }
+        if (i == n - 1) {
+            ctrl |= CTRL_TXEOF;
+        }
+        bits += fill_random(qts, buf, lens[i]);
+        write_desc(qts, desc, desc + DESC_ALIGN, buf, ctrl);
+    }
+
+    qtest_writel(qts, MM2S_CURDESC, DESC_ADDR);
+    qtest_writel(qts, MM2S_DMACR, DMACR_RS | DMACR_IOC_IRQ_EN);
+    qtest_writel(qts, MM2S_TAILDESC, DESC_ADDR + (n - 1) * DESC_ALIGN);
+    wait_idle(qts, MM2S_DMASR);
+
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, bits);
+    g_assert_true(qtest_readl(qts, MM2S_DMASR) & DMASR_IOC_IRQ);
+    g_assert_cmphex(qtest_readl(qts, MM2S_CURDESC), ==,
+                    DESC_ADDR + (n - 1) * DESC_ALIGN);
+    for (int i = 0; i < n; i++) {
+        g_assert_cmphex(qtest_readl(qts, DESC_ADDR + i * DESC_ALIGN +
+                                    DESC_STATUS), ==, STS_CMPLT | lens[i]);
+    }
+
+    qtest_quit(qts);
+}
+
+static void test_s2mm_blocks(void)
+{
+    QTestState *qts = qtest_init("-machine virt "
+                                 "-global popcount.block-size=4096");
+    const uint32_t len = 4 * 4 * KiB + 100;
+    uint32_t expect[5], got[5];
+
+    for (int i = 0; i < ARRAY_SIZE(expect); i++) {
+        expect[i] = fill_random(qts, SRC_ADDR + i * 4 * KiB,
+                                MIN(len - i * 4 * KiB, 4 * KiB));
+    }
+
+    qtest_writel(qts, S2MM_DMACR, DMACR_RS | DMACR_IOC_IRQ_EN);
+    qtest_writel(qts, S2MM_DA, DST_ADDR);
+    qtest_writel(qts, S2MM_LENGTH, 4 * KiB);
+    qtest_writel(qts, MM2S_DMACR, DMACR_RS);
+    mm2s_simple(qts, SRC_ADDR, len);
+    wait_idle(qts, MM2S_DMASR);
+    wait_idle(qts, S2MM_DMASR);
+
+    g_assert_true(qtest_readl(qts, S2MM_DMASR) & DMASR_IOC_IRQ);
+    g_assert_cmpuint(qtest_readl(qts, S2MM_LENGTH), ==, sizeof(got));
+    qtest_memread(qts, DST_ADDR, got, sizeof(got));
+    for (int i = 0; i < ARRAY_SIZE(expect); i++) {
+        g_assert_cmpuint(le32_to_cpu(got[i]), ==, expect[i]);
+    }
+
+    /* A packet that does not fit the buffer is an error */
+    qtest_writel(qts, S2MM_LENGTH, 8);
+    mm2s_simple(qts, SRC_ADDR, len);
+    wait_idle(qts, MM2S_DMASR);
+    g_assert_cmphex(qtest_readl(qts, S2MM_DMASR) &
+                    (DMASR_HALTED | DMASR_DMA_INT_ERR | DMASR_ERR_IRQ), ==,
+                    DMASR_HALTED | DMASR_DMA_INT_ERR | DMASR_ERR_IRQ);
+
+    qtest_quit(qts);
+}
+
+static void test_kernel_sum_xor(void)
+{
+    QTestState *sum = qtest_init("-machine virt -global popcount.kernel=sum");
+    QTestState *xor = qtest_init("-machine virt -global popcount.kernel=xor");
+    uint32_t s = 0, x = 0;
+
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = g_test_rand_int();
+
+        qtest_writel(sum, POP_DATA, v);
+        qtest_writel(xor, POP_DATA, v);
+        s += v;
+        x ^= v;
+    }
+    g_assert_cmphex(qtest_readl(sum, POP_DATA), ==, s);
+    g_assert_cmphex(qtest_readl(xor, POP_DATA), ==, x);
+
+    qtest_quit(sum);
+    qtest_quit(xor);
+}
+
+static void test_kernel_crc32c(void)
+{
+    QTestState *qts = qtest_init("-machine virt "
+                                 "-global popcount.kernel=crc32c");
+
+    /* CRC-32C of "12345678"; the stream only carries whole words */
+    qtest_memwrite(qts, SRC_ADDR, "12345678", 8);
+    qtest_writel(qts, MM2S_DMACR, DMACR_RS);
+    mm2s_simple(qts, SRC_ADDR, 8);
+    wait_idle(qts, MM2S_DMASR);
+    g_assert_cmphex(qtest_readl(qts, POP_DATA), ==, 0x6087809a);
+
+    qtest_quit(qts);
+}
+
+/* The result must not depend on how the stream is cut into chunks */
+static void test_kernel_crc32c_chunks(void)
+{
+    static const uint32_t lens[] = { 4, 12, 1000, 2048, 1032 };
+    QTestState *qts = qtest_init("-machine virt "
+                                 "-global popcount.kernel=crc32c");
+    g_autofree uint8_t *buf = g_malloc(4 * KiB);
+    int n = ARRAY_SIZE(lens);
+    uint32_t expect, off = 0;
+
+    for (int i = 0; i < 4 * KiB; i++) {
+        buf[i] = g_test_rand_int();
+    }
+    qtest_bufwrite(qts, SRC_ADDR, buf, 4 * KiB);
+    expect = crc32c(0xffffffff, buf, 4 * KiB);
+
+    /* Scatter-gather, one packet over buffers of different sizes */
+    for (int i = 0; i < n; i++) {
+        uint64_t desc = DESC_ADDR + i * DESC_ALIGN;
+        uint32_t ctrl = lens[i];
+
+        if (i == 0) {
+            ctrl |= CTRL_TXSOF;
+        }
+        if (i == n - 1) {
+            ctrl |= CTRL_TXEOF;
+        }
+        write_desc(qts, desc, desc + DESC_ALIGN, SRC_ADDR + off, ctrl);
+        off += lens[i];
+    }
+    g_assert_cmpuint(off, ==, 4 * KiB);
+    qtest_writel(qts, MM2S_CURDESC, DESC_ADDR);
+    qtest_writel(qts, MM2S_DMACR, DMACR_RS);
+    qtest_writel(qts, MM2S_TAILDESC, DESC_ADDR + (n - 1) * DESC_ALIGN);
+    wait_idle(qts, MM2S_DMASR);
+    g_assert_cmphex(qtest_readl(qts, POP_DATA), ==, expect);
+
+    /* A single simple transfer */
+    qtest_writel(qts, POP_RESET, 1);
+    mm2s_simple(qts, SRC_ADDR, 4 * KiB);
+    wait_idle(qts, MM2S_DMASR);
+    g_assert_cmphex(qtest_readl(qts, POP_DATA), ==, expect);
+
+    /* The data port, one word at a time */
+    qtest_writel(qts, POP_RESET, 1);
+    for (int i = 0; i < 4 * KiB; i += 4) {
+        qtest_writel(qts, POP_DATA, ldl_le_p(buf + i));
+    }
+    g_assert_cmphex(qtest_readl(qts, POP_DATA), ==, expect);
+
+    qtest_quit(qts);
+}
+
+static void test_timing_model(void)
+{
+    QTestState *qts = qtest_init("-machine virt "
+                                 "-global popcount.word-latency-ns=10 "
+                                 "-global popcount.transfer-latency-ns=1000");
+    uint32_t bits = fill_random(qts, SRC_ADDR, 4 * KiB);
+
+    qtest_writel(qts, MM2S_DMACR, DMACR_RS);
+    mm2s_simple(qts, SRC_ADDR, 4 * KiB);
+
+    /* With the virtual clock stopped the transfer cannot complete */
+    g_usleep(10 * 1000);
+    g_assert_false(qtest_readl(qts, MM2S_DMASR) & DMASR_IDLE);
+    qtest_clock_step(qts, 1024 * 10 + 1000 - 1);
+    g_usleep(10 * 1000);
+    g_assert_false(qtest_readl(qts, MM2S_DMASR) & DMASR_IDLE);
+
+    qtest_clock_step(qts, 1);
+    wait_idle(qts, MM2S_DMASR);
+    g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, bits);
+
+    qtest_quit(qts);
+}
+
+/*
+ * Migrate while a scatter-gather transfer is in flight, with its descriptor
+ * above 4 GiB; the destination must pick the ring up at the same address,
+ * but only once it runs.
+ */
+static void test_migrate_sg_high(void)
+{
+    const char *args = "-machine virt -m 3G "
+                       "-global popcount.word-latency-ns=10 "
+                       "-global popcount.transfer-latency-ns=1000";
+    g_autofree char *tmpdir = g_dir_make_tmp("popcount-test-XXXXXX", NULL);
+    g_autofree char *uri = NULL;
+    QTestState *from, *to;
+    uint32_t bits;
+
+    g_assert(tmpdir);
+    uri = g_strdup_printf("unix:%s/migsocket", tmpdir);
+    from = qtest_initf("%s", args);
+    to = qtest_initf("%s -S -incoming %s", args, uri);
+
+    bits = fill_random(from, SRC_ADDR, 4 * KiB);
+    write_desc(from, HIGH_DESC_ADDR, HIGH_DESC_ADDR, SRC_ADDR,
+               4 * KiB | CTRL_TXSOF | CTRL_TXEOF);
+    qtest_writel(from, MM2S_CURDESC, HIGH_DESC_ADDR);
+    qtest_writel(from, MM2S_CURDESC_MSB, HIGH_DESC_ADDR >> 32);
+    qtest_writel(from, MM2S_DMACR, DMACR_RS);
+    qtest_writel(from, MM2S_TAILDESC_MSB, HIGH_DESC_ADDR >> 32);
+    qtest_writel(from, MM2S_TAILDESC, HIGH_DESC_ADDR);
+
+    /* The virtual clock is stopped, so the transfer is still running */
+    g_assert_false(qtest_readl(from, MM2S_DMASR) & DMASR_IDLE);
+
+    migrate_qmp(from, uri, "{}");
+    wait_for_migration_complete(from);
+
+    /* Nothing is fetched or written back while the destination is paused */
+    g_usleep(10 * 1000);
+    g_assert_false(qtest_readl(to, MM2S_DMASR) & DMASR_IDLE);
+    g_assert_cmphex(qtest_readl(to, HIGH_DESC_ADDR + DESC_STATUS), ==, 0);
+
+    qtest_qmp_assert_success(to, "{ 'execute': 'cont' }");
+    qtest_clock_step(to, 1024 * 10 + 1000);
+    wait_idle(to, MM2S_DMASR);
+
+    g_assert_cmpuint(qtest_readl(to, POP_DATA), ==, bits);
+    g_assert_cmphex(qtest_readl(to, MM2S_CURDESC), ==,
+                    (uint32_t)HIGH_DESC_ADDR);
+    g_assert_cmphex(qtest_readl(to, MM2S_CURDESC_MSB), ==,
+                    HIGH_DESC_ADDR >> 32);
+    g_assert_cmphex(qtest_readl(to, HIGH_DESC_ADDR + DESC_STATUS), ==,
+                    STS_CMPLT | 4 * KiB);
+
+    qtest_quit(to);
+    qtest_quit(from);
+    unlink(uri + strlen("unix:"));
+    rmdir(tmpdir);
+}
+
+/* MM2S length is 26 bits, so larger transfers are split across descriptors */
+#define BENCH_DESC_MAX      (32 * MiB)
+#define BENCH_TOTAL         (1 * GiB)
+#define BENCH_ITER_MAX      4096
+
+static void test_mm2s_speed(const void *opaque)
+{
+    size_t size = (uintptr_t)opaque;
+    int ndescs = DIV_ROUND_UP(size, BENCH_DESC_MAX);
+    int iters = MIN(MAX(BENCH_TOTAL / size, 1), BENCH_ITER_MAX);
+    uint64_t tail = DESC_ADDR + (ndescs - 1) * DESC_ALIGN;
+    QTestState *qts = qtest_init("-machine virt -m 256M");
+    double secs;
+
+    /* 0x55 has four bits set in every byte */
+    qtest_memset(qts, SRC_ADDR, 0x55, size);
+    for (int i = 0; i < ndescs; i++) {
+        uint64_t desc = DESC_ADDR + i * DESC_ALIGN;
+        uint32_t len = MIN(size - i * BENCH_DESC_MAX, BENCH_DESC_MAX);
+
+        /* The tail links back to the head, so each doorbell reruns the ring */
+        write_desc(qts, desc, i == ndescs - 1 ? DESC_ADDR : desc + DESC_ALIGN,
+                   SRC_ADDR + i * BENCH_DESC_MAX,
+                   len | (i == ndescs - 1 ? CTRL_TXEOF : 0));
+    }
+    qtest_writel(qts, MM2S_CURDESC, DESC_ADDR);
+    qtest_writel(qts, MM2S_DMACR, DMACR_RS);
+
+    g_test_timer_start();
+    for (int i = 0; i < iters; i++) {
+        for (int j = 0; j < ndescs; j++) {
+            qtest_writel(qts, DESC_ADDR + j * DESC_ALIGN + DESC_STATUS, 0);
+        }
+        qtest_writel(qts, POP_RESET, 1);
+        qtest_writel(qts, MM2S_TAILDESC, tail);
+        wait_idle(qts, MM2S_DMASR);
+        g_assert_cmpuint(qtest_readl(qts, POP_DATA), ==, size * 4);
+    }
+    secs = g_test_timer_elapsed();
+
+    g_test_message("mm2s: size %zu bytes %.2f MB/sec %.0f transfers/sec",
+                   size, (double)size * iters / MiB / secs, iters / secs);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/popcount/reset-values", test_reset_values);
+    qtest_add_func("/popcount/data-port", test_data_port);
+    qtest_add_func("/popcount/mm2s/simple", test_mm2s_simple);
+    qtest_add_func("/popcount/mm2s/sg", test_mm2s_sg);
+    qtest_add_func("/popcount/s2mm/blocks", test_s2mm_blocks);
+    qtest_add_func("/popcount/kernel/sum-xor", test_kernel_sum_xor);
+    qtest_add_func("/popcount/kernel/crc32c", test_kernel_crc32c);
+    qtest_add_func("/popcount/kernel/crc32c-chunks",
+                   test_kernel_crc32c_chunks);
+    qtest_add_func("/popcount/timing-model", test_timing_model);
+    qtest_add_func("/popcount/migrate/sg-high", test_migrate_sg_high);
+
+    if (g_test_perf()) {
+        for (size_t size = 4 * KiB; size <= 64 * MiB; size *= 4) {
+            g_autofree char *name =
+                g_strdup_printf("/popcount/benchmark/mm2s/bufsize-%zu", size);
+
+            qtest_add_data_func(name, (void *)(uintptr_t)size,
+                                test_mm2s_speed);
+        }
+    }
+
+    return g_test_run();
+}
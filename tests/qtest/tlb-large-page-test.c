@@ -0,0 +1,130 @@
+/*
+ * QTest testcase for targeted TLB flushes of large pages
+ *
+ * A small firmware maps the first 4 GiB with 4 MiB pages, touches one
+ * large page and then invalidates the 256 small pages that it covers.
+ * Only the first invlpg may have to scan the TLB: after that the area
+ * covered by large pages no longer includes the flushed page.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define BIOS_SIZE       0x10000
+#define DONE_ADDR       0x2000
+#define DONE_MAGIC      0x600df00d
+
+/* Loaded at f000:0000, entered from the reset vector below. */
+static const uint8_t bios_code[] = {
+    0xfa,                                   /* cli */
+    0x2e, 0x66, 0x0f, 0x01, 0x16, 0x98, 0x00, /* lgdtl %cs:0x98 */
+    0x0f, 0x20, 0xc0,                       /* mov %cr0,%eax */
+    0x66, 0x83, 0xc8, 0x01,                 /* or $0x1,%eax */
+    0x0f, 0x22, 0xc0,                       /* mov %eax,%cr0 */
+    0x66, 0xea, 0x1a, 0x00, 0x0f, 0x00,     /* ljmpl $0x8,$0xf001a */
+    0x08, 0x00,
+    /* 32-bit protected mode */
+    0x66, 0xb8, 0x10, 0x00,                 /* mov $0x10,%ax */
+    0x8e, 0xd8,                             /* mov %ax,%ds */
+    0x8e, 0xc0,                             /* mov %ax,%es */
+    0x8e, 0xd0,                             /* mov %ax,%ss */
+    0xbf, 0x00, 0x10, 0x00, 0x00,           /* mov $0x1000,%edi */
+    0x31, 0xc9,                             /* xor %ecx,%ecx */
+    0x89, 0xc8,                             /* 1: mov %ecx,%eax */
+    0xc1, 0xe0, 0x16,                       /* shl $22,%eax */
+    0x0d, 0x83, 0x00, 0x00, 0x00,           /* or $0x83,%eax (P|RW|PS) */
+    0x89, 0x04, 0x8f,                       /* mov %eax,(%edi,%ecx,4) */
+    0x41,                                   /* inc %ecx */
+    0x81, 0xf9, 0x00, 0x04, 0x00, 0x00,     /* cmp $1024,%ecx */
+    0x75, 0xea,                             /* jne 1b */
+    0x0f, 0x20, 0xe0,                       /* mov %cr4,%eax */
+    0x83, 0xc8, 0x10,                       /* or $0x10,%eax (PSE) */
+    0x0f, 0x22, 0xe0,                       /* mov %eax,%cr4 */
+    0x0f, 0x22, 0xdf,                       /* mov %edi,%cr3 */
+    0x0f, 0x20, 0xc0,                       /* mov %cr0,%eax */
+    0x0d, 0x00, 0x00, 0x00, 0x80,           /* or $0x80000000,%eax (PG) */
+    0x0f, 0x22, 0xc0,                       /* mov %eax,%cr0 */
+    0xa1, 0x00, 0x00, 0x80, 0x00,           /* mov 0x800000,%eax */
+    0xbb, 0x00, 0x00, 0x80, 0x00,           /* mov $0x800000,%ebx */
+    0xb9, 0x00, 0x01, 0x00, 0x00,           /* mov $256,%ecx */
+    0x0f, 0x01, 0x3b,                       /* 2: invlpg (%ebx) */
+    0x81, 0xc3, 0x00, 0x10, 0x00, 0x00,     /* add $0x1000,%ebx */
+    0xe2, 0xf5,                             /* loop 2b */
+    0xc7, 0x05, 0x00, 0x20, 0x00, 0x00,     /* movl $DONE_MAGIC,DONE_ADDR */
+    0x0d, 0xf0, 0x0d, 0x60,
+    0xf4,                                   /* 3: hlt */
+    0xeb, 0xfd,                             /* jmp 3b */
+    0x90,
+    /* 0x80: GDT */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x9a, 0xcf, 0x00, /* flat code */
+    0xff, 0xff, 0x00, 0x00, 0x00, 0x92, 0xcf, 0x00, /* flat data */
+    /* 0x98: GDT descriptor */
+    0x17, 0x00, 0x80, 0x00, 0x0f, 0x00,
+};
+
+static const uint8_t bios_reset[] = {
+    0xea, 0x00, 0x00, 0x00, 0xf0,           /* ljmp $0xf000,$0x0 */
+};
+
+static size_t large_page_flushes(QTestState *qts)
+{
+    g_autofree char *info = qtest_hmp(qts, "info jit");
+    const char *p = strstr(info, "large page flushes ");
+
+    g_assert(p);
+    return strtoul(p + strlen("large page flushes "), NULL, 10);
+}
+
+static void test_invlpg_in_large_page(void)
+{
+    g_autofree uint8_t *bios = g_malloc0(BIOS_SIZE);
+    g_autofree char *biostmp = NULL;
+    QTestState *qts;
+    size_t flushes;
+    ssize_t wlen;
+    int fd, i;
+
+    memcpy(bios, bios_code, sizeof(bios_code));
+    memcpy(bios + BIOS_SIZE - 16, bios_reset, sizeof(bios_reset));
+
+    fd = g_file_open_tmp("qtest-tlb-bios-XXXXXX", &biostmp, NULL);
+    g_assert(fd != -1);
+    wlen = write(fd, bios, BIOS_SIZE);
+    g_assert(wlen == BIOS_SIZE);
+    close(fd);
+
+    qts = qtest_initf("-M pc -accel tcg -bios %s", biostmp);
+    unlink(biostmp);
+
+    for (i = 0; i < 600; i++) {
+        if (qtest_readl(qts, DONE_ADDR) == DONE_MAGIC) {
+            break;
+        }
+        g_usleep(100 * 1000);
+    }
+    g_assert_cmphex(qtest_readl(qts, DONE_ADDR), ==, DONE_MAGIC);
+
+    /* Without resetting the tracked area every invlpg would scan. */
+    flushes = large_page_flushes(qts);
+    g_assert_cmpuint(flushes, >=, 1);
+    g_assert_cmpuint(flushes, <, 16);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG is not available");
+        return g_test_run();
+    }
+
+    qtest_add_func("/tlb/large-page/invlpg", test_invlpg_in_large_page);
+
+    return g_test_run();
+}
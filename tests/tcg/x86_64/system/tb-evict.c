@@ -0,0 +1,60 @@
+/*
+ * Translation cache eviction test
+ *
+ * Copy a small function to many addresses and call every copy, so that
+ * the translated code outgrows the small code buffer the test is run
+ * with (see Makefile.softmmu-target) and the oldest regions are evicted.
+ * Every round checks that all the copies still run correctly.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define COPY_STRIDE 512
+#define NR_COPIES   16384
+#define ROUNDS      3
+
+/* 64 separate adds keep the translated code of each copy large */
+asm(".pushsection .text\n"
+    "blob_start:\n"
+    "    mov %rdi, %rax\n"
+    "    .rept 64\n"
+    "    add $1, %rax\n"
+    "    .endr\n"
+    "    ret\n"
+    "blob_end:\n"
+    ".popsection\n");
+
+extern const uint8_t blob_start[], blob_end[];
+
+static uint8_t area[NR_COPIES * COPY_STRIDE] __attribute__((aligned(4096)));
+
+int main(void)
+{
+    int len = blob_end - blob_start;
+    int i, j, r;
+
+    for (i = 0; i < NR_COPIES; i++) {
+        for (j = 0; j < len; j++) {
+            area[i * COPY_STRIDE + j] = blob_start[j];
+        }
+    }
+
+    for (r = 0; r < ROUNDS; r++) {
+        for (i = 0; i < NR_COPIES; i++) {
+            uint64_t (*fn)(uint64_t) = (void *)&area[i * COPY_STRIDE];
+            uint64_t ret = fn(i);
+
+            if (ret != i + 64) {
+                ml_printf("round %d copy %d: got %ld, expected %d\n",
+                          r, i, ret, i + 64);
+                return 1;
+            }
+        }
+    }
+
+    ml_printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * QEMU buffer_popcount test
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/host-utils.h"
+
+static uint8_t buffer[1024 * 1024];
+
+static uint64_t reference_popcount(const uint8_t *buf, size_t len)
+{
+    uint64_t ret = 0;
+
+    while (len--) {
+        ret += ctpop8(*buf++);
+    }
+    return ret;
+}
+
+static void test_1(void)
+{
+    size_t s, a;
+
+    /* All-zero and all-one buffers.  */
+    memset(buffer, 0, sizeof(buffer));
+    g_assert_cmpuint(buffer_popcount(buffer, sizeof(buffer)), ==, 0);
+    memset(buffer, 0xff, sizeof(buffer));
+    g_assert_cmpuint(buffer_popcount(buffer, sizeof(buffer)), ==,
+                     sizeof(buffer) * 8);
+
+    /* Random contents over every size and alignment of interest.  */
+    for (s = 0; s < sizeof(buffer); s++) {
+        buffer[s] = g_test_rand_int();
+    }
+    g_assert_cmpuint(buffer_popcount(buffer, sizeof(buffer)), ==,
+                     reference_popcount(buffer, sizeof(buffer)));
+    for (a = 0; a < 64; a++) {
+        for (s = 0; s < 1024; s++) {
+            g_assert_cmpuint(buffer_popcount(buffer + a, s), ==,
+                             reference_popcount(buffer + a, s));
+        }
+    }
+}
+
+static void test_2(void)
+{
+    if (g_test_perf()) {
+        test_1();
+    } else {
+        do {
+            test_1();
+        } while (test_buffer_popcount_next_accel());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/bufferpopcount", test_2);
+
+    return g_test_run();
+}
@@ -173,6 +173,18 @@ static void test_encode_decode(void)
     }
 }
 
+/* Repeat the checks above with every encoder the host supports. */
+static void test_encode_decode_accel(void)
+{
+    while (test_xbzrle_encode_next_accel()) {
+        test_encode_decode_zero();
+        test_encode_decode_unchanged();
+        test_encode_decode_1_byte();
+        test_encode_decode_overflow();
+        test_encode_decode();
+    }
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +197,7 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_decode_accel", test_encode_decode_accel);
 
     return g_test_run();
 }
@@ -0,0 +1,220 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Count the set bits in a buffer, using host vector units where available.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "host/cpuinfo.h"
+
+static uint64_t
+buffer_popcount_int(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    const unsigned char *e = p + (len & -8);
+    uint64_t t0 = 0, t1 = 0;
+
+    /* Two independent accumulators hide the latency of the adds.  */
+    for (; p + 16 <= e; p += 16) {
+        t0 += ctpop64(ldq_he_p(p));
+        t1 += ctpop64(ldq_he_p(p + 8));
+    }
+    if (p < e) {
+        t0 += ctpop64(ldq_he_p(p));
+        p += 8;
+    }
+    for (e = buf + len; p < e; p++) {
+        t1 += ctpop8(*p);
+    }
+    return t0 + t1;
+}
+
+#if defined(CONFIG_CPUID_H) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+
+static uint64_t __attribute__((target("popcnt")))
+buffer_popcount_popcnt(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    const unsigned char *e = p + (len & -32);
+    uint64_t t0 = 0, t1 = 0, t2 = 0, t3 = 0;
+
+    for (; p < e; p += 32) {
+        t0 += __builtin_popcountll(ldq_he_p(p));
+        t1 += __builtin_popcountll(ldq_he_p(p + 8));
+        t2 += __builtin_popcountll(ldq_he_p(p + 16));
+        t3 += __builtin_popcountll(ldq_he_p(p + 24));
+    }
+    return t0 + t1 + t2 + t3 + buffer_popcount_int(p, len & 31);
+}
+
+#ifdef CONFIG_AVX2_OPT
+/*
+ * Nibble lookup with vpshufb, summed horizontally with vpsadbw.
+ * Note that this requires len >= 32.
+ */
+static uint64_t __attribute__((target("avx2")))
+buffer_popcount_avx2(const void *buf, size_t len)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    const unsigned char *p = buf;
+    const unsigned char *e = p + (len & -32);
+    __m256i acc = zero;
+    uint64_t lanes[4];
+
+    while (p < e) {
+        /* Each byte lane gains at most 8 per block: flush before 255.  */
+        const unsigned char *l = p + MIN(e - p, 31 * 32);
+        __m256i t = zero;
+
+        for (; p < l; p += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            __m256i lo = _mm256_and_si256(v, mask);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+
+            t = _mm256_add_epi8(t, _mm256_shuffle_epi8(lut, lo));
+            t = _mm256_add_epi8(t, _mm256_shuffle_epi8(lut, hi));
+        }
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(t, zero));
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+        + buffer_popcount_int(p, len & 31);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512F_OPT
+static uint64_t __attribute__((target("avx512f,avx512vpopcntdq")))
+buffer_popcount_avx512(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    const unsigned char *e = p + (len & -128);
+    __m512i t0 = _mm512_setzero_si512();
+    __m512i t1 = _mm512_setzero_si512();
+
+    for (; p < e; p += 128) {
+        t0 = _mm512_add_epi64(t0, _mm512_popcnt_epi64(_mm512_loadu_si512(p)));
+        t1 = _mm512_add_epi64(t1,
+                              _mm512_popcnt_epi64(_mm512_loadu_si512(p + 64)));
+    }
+    return _mm512_reduce_add_epi64(_mm512_add_epi64(t0, t1))
+        + buffer_popcount_int(p, len & 127);
+}
+#endif /* CONFIG_AVX512F_OPT */
+
+static unsigned used_accel;
+static unsigned length_to_accel;
+static uint64_t (*buffer_accel)(const void *, size_t) = buffer_popcount_int;
+
+static unsigned __attribute__((noinline))
+select_accel_cpuinfo(unsigned info)
+{
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        unsigned len;
+        uint64_t (*fn)(const void *, size_t);
+    } all[] = {
+#ifdef CONFIG_AVX512F_OPT
+        { CPUINFO_AVX512VPOPCNTDQ, 256, buffer_popcount_avx512 },
+#endif
+#ifdef CONFIG_AVX2_OPT
+        { CPUINFO_AVX2,            256, buffer_popcount_avx2 },
+#endif
+        { CPUINFO_POPCNT,            0, buffer_popcount_popcnt },
+        { CPUINFO_ALWAYS,            0, buffer_popcount_int },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        if (info & all[i].bit) {
+            length_to_accel = all[i].len;
+            buffer_accel = all[i].fn;
+            return all[i].bit;
+        }
+    }
+    return 0;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+
+bool test_buffer_popcount_next_accel(void)
+{
+    /*
+     * Accumulate the accelerators that we've already tested, and
+     * remove them from the set to test this round.  We'll get back
+     * a zero from select_accel_cpuinfo when there are no more.
+     */
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+    used_accel |= used;
+    return used;
+}
+
+static uint64_t select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= length_to_accel)) {
+        return buffer_accel(buf, len);
+    }
+    return buffer_popcount_int(buf, len);
+}
+
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+/* Advanced SIMD is architecturally guaranteed, so there is nothing to pick. */
+static uint64_t select_accel_fn(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    const uint8_t *e = p + (len & -16);
+    uint64_t ret = 0;
+
+    while (p < e) {
+        /* Each 16-bit lane gains at most 16 per block: flush before 65535. */
+        const uint8_t *l = p + MIN(e - p, 2048 * 16);
+        uint16x8_t t = vdupq_n_u16(0);
+
+        for (; p < l; p += 16) {
+            t = vpadalq_u8(t, vcntq_u8(vld1q_u8(p)));
+        }
+        ret += vaddlvq_u16(t);
+    }
+    return ret + buffer_popcount_int(p, len & 15);
+}
+
+bool test_buffer_popcount_next_accel(void)
+{
+    return false;
+}
+
+#else
+#define select_accel_fn  buffer_popcount_int
+bool test_buffer_popcount_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+ * Returns the number of set bits in a buffer
+ */
+uint64_t buffer_popcount(const void *buf, size_t len)
+{
+    if (unlikely(len == 0)) {
+        return 0;
+    }
+
+    /* Fetch the beginning of the buffer while we select the accelerator.  */
+    __builtin_prefetch(buf);
+
+    return select_accel_fn(buf, len);
+}
@@ -54,6 +54,8 @@ unsigned __attribute__((constructor)) cpuinfo_init(void)
                     info |= (b7 & bit_AVX512BW ? CPUINFO_AVX512BW : 0);
                     info |= (b7 & bit_AVX512DQ ? CPUINFO_AVX512DQ : 0);
                     info |= (c7 & bit_AVX512VBMI2 ? CPUINFO_AVX512VBMI2 : 0);
+                    info |= (c7 & bit_AVX512VPOPCNTDQ
+                             ? CPUINFO_AVX512VPOPCNTDQ : 0);
                 }
 
                 /*